@@ -0,0 +1,52 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	// per thread so counting does not make every allocation in the program share a cache line
+	thread_local size_t threadCount = 0;
+
+	void* CountedAlloc(size_t size)
+	{
+		threadCount++;
+		if (void* p = std::malloc(size ? size : 1))
+			return p;
+		throw std::bad_alloc();
+	}
+}
+
+size_t AllocationCounter::ThreadAllocations()
+{
+	return threadCount;
+}
+
+void* operator new(size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void* operator new[](size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
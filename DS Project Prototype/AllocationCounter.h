@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+
+// counts calls to the global operator new, used by the benchmarks to check that hot paths do not allocate
+namespace AllocationCounter
+{
+	// allocations made by the calling thread since it started
+	size_t ThreadAllocations();
+}
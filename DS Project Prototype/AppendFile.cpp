@@ -0,0 +1,38 @@
+#include "AppendFile.h"
+#include <Windows.h>
+#include <exception>
+
+AppendFile::AppendFile(const std::string& filename, bool truncate)
+{
+	// readers map the file while it is being appended to
+	HANDLE file = CreateFileA(filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::exception("Could not open file for appending");
+	handle = file;
+}
+
+AppendFile::~AppendFile()
+{
+	CloseHandle(handle);
+}
+
+void AppendFile::Write(const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		// WriteFile takes a DWORD length, so large buffers go in pieces
+		DWORD chunk = len > 0x40000000 ? 0x40000000 : DWORD(len);
+		DWORD written = 0;
+		if (!WriteFile(handle, data, chunk, &written, nullptr) || written == 0)
+			throw std::exception("Could not write to file");
+		data += written;
+		len -= written;
+	}
+}
+
+void AppendFile::Sync()
+{
+	if (!FlushFileBuffers(handle))
+		throw std::exception("Could not flush file to disk");
+}
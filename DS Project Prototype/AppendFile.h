@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// write only handle to a file that is only ever appended to
+// unlike std::ofstream it can force what was written out to the disk
+class AppendFile
+{
+public:
+	// creates the file if it does not exist, truncate empties it if it does
+	// throws if the file cannot be opened
+	AppendFile(const std::string& filename, bool truncate);
+	~AppendFile();
+	AppendFile(const AppendFile&) = delete;
+	AppendFile& operator=(const AppendFile&) = delete;
+
+	// writes all len bytes at the end of the file, throws if it cannot
+	void Write(const char* data, size_t len);
+	// waits until everything written so far is on the disk, throws if it cannot
+	void Sync();
+
+private:
+	// a windows HANDLE, kept as void* so Windows.h stays out of the header
+	void* handle = nullptr;
+};
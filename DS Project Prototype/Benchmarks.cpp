@@ -0,0 +1,891 @@
+#include "Benchmarks.h"
+#include "ProcessManager.h"
+#include "ProcessMessages.h"
+#include "AllocationCounter.h"
+#include "HashEngine.h"
+#include "Sha256.h"
+#include "BlockLog.h"
+#include "FastMod.h"
+#include "Random.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// empty message used to time the dispatch path on its own
+	class PingMessage : public ProcessManager::Message
+	{
+	public:
+		PingMessage()
+			:
+			ProcessManager::Message(std::type_index(typeid(PingMessage)), 0)
+		{}
+		// set the time the message is handed to the manager
+		void Stamp()
+		{
+			sent = Clock::now().time_since_epoch().count();
+		}
+		// called by every handler, only the first one is recorded
+		void MarkPickedUp()
+		{
+			long long now = Clock::now().time_since_epoch().count();
+			long long expected = 0;
+			firstStart.compare_exchange_strong(expected, now);
+		}
+		// nanoseconds between Stamp() and the first handler starting
+		double GetLatencyNs() const
+		{
+			return double(firstStart.load() - sent) * Clock::period::num * 1e9 / Clock::period::den;
+		}
+	private:
+		long long sent = 0;
+		std::atomic<long long> firstStart = 0;
+	};
+
+	// the value at quantile q of sorted samples
+	double Quantile(const std::vector<double>& sorted, double q)
+	{
+		return sorted[std::min(sorted.size() - 1, size_t(q * sorted.size()))];
+	}
+
+	// prints min/p50/p99/max of a set of samples in microseconds
+	void PrintLatencies(const std::string& name, std::vector<double> samples_ns)
+	{
+		std::sort(samples_ns.begin(), samples_ns.end());
+		auto at = [&samples_ns](double q)
+		{
+			return Quantile(samples_ns, q) / 1000.0;
+		};
+		std::cout << name << ": min " << at(0.0) << "us, p50 " << at(0.5) << "us, p99 "
+			<< at(0.99) << "us, max " << samples_ns.back() / 1000.0 << "us" << std::endl;
+	}
+
+	// user plus kernel time of the whole process so far
+	double ProcessCpuSeconds()
+	{
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+			return 0.0;
+		auto seconds = [](const FILETIME& t)
+		{
+			return ((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 1e7;
+		};
+		return seconds(kernel) + seconds(user);
+	}
+
+	// the pretty printed json text the miners stored blocks in before the binary log, kept to compare against
+	std::string JsonFilename(size_t PID)
+	{
+		return "process-" + std::to_string(PID) + ".json";
+	}
+	void JsonAppend(const std::string& filename, const nlohmann::json& j)
+	{
+		std::ofstream out(filename, std::ios::app);
+		out << std::endl << std::setw(4) << j;
+	}
+	template <typename Pred>
+	nlohmann::json JsonScan(const std::string& filename, Pred p)
+	{
+		nlohmann::json arr = nlohmann::json::array();
+		std::ifstream in(filename);
+		while (in.peek() != EOF)
+		{
+			nlohmann::json obj;
+			in >> obj;
+			if (!obj.is_null() && p(obj))
+				arr.push_back(obj);
+		}
+		return arr;
+	}
+
+	uint64_t FileBytes(const std::string& filename)
+	{
+		std::error_code ec;
+		auto size = std::filesystem::file_size(filename, ec);
+		return ec ? 0 : size;
+	}
+
+	// runs f runs times and returns the median time in milliseconds
+	template <typename F>
+	double MedianMs(size_t runs, F f)
+	{
+		std::vector<double> times;
+		for (size_t i = 0; i < runs; i++)
+		{
+			auto start = Clock::now();
+			f();
+			times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+		std::sort(times.begin(), times.end());
+		return Quantile(times, 0.5);
+	}
+
+	// runs f inside a fresh temporary directory and restores the working directory afterwards
+	template <typename F>
+	void InScratchDirectory(F f)
+	{
+		namespace fs = std::filesystem;
+		auto prev = fs::current_path();
+		auto dir = fs::temp_directory_path() / "ds-project-bench";
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+		fs::current_path(dir);
+		f();
+		fs::current_path(prev);
+		fs::remove_all(dir);
+	}
+}
+
+void Benchmarks::DispatchLatency(size_t num_processes, size_t iterations)
+{
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	{
+		ProcessManager pm(num_processes);
+		pm.AddMessageHandler(typeid(PingMessage),
+			[](ProcessManager::MsgPtr msg_in, const ProcessManager::MinerContext&)
+			{
+				((PingMessage*)msg_in.get())->MarkPickedUp();
+				return std::optional<Block>(Block());
+			}
+		);
+
+		for (size_t i = 0; i < iterations; i++)
+		{
+			auto msg = std::make_shared<PingMessage>();
+			msg->Stamp();
+			pm.MineBlock(msg);
+			samples.push_back(msg->GetLatencyNs());
+		}
+	}
+	PrintLatencies("broadcast to first handler (" + std::to_string(num_processes) + " miners)", samples);
+}
+
+bool Benchmarks::MessageAllocations(size_t messages)
+{
+	// messages are made and dropped a batch at a time, like blocks in flight
+	constexpr size_t batch = 64;
+	std::vector<std::shared_ptr<PingMessage>> live;
+	live.reserve(batch);
+	auto run = [&](const char* label, auto make)
+	{
+		const size_t allocs = AllocationCounter::ThreadAllocations();
+		auto start = Clock::now();
+		for (size_t i = 0; i < messages; i++)
+		{
+			live.push_back(make());
+			if (live.size() == batch)
+				live.clear();
+		}
+		live.clear();
+		double s = std::chrono::duration<double>(Clock::now() - start).count();
+		size_t made = AllocationCounter::ThreadAllocations() - allocs;
+		std::cout << label << ": " << s * 1e9 / messages << " ns/message, "
+			<< double(made) / messages << " allocations/message" << std::endl;
+		return made;
+	};
+
+	run("make_shared", []() { return std::make_shared<PingMessage>(); });
+	MessagePool pool;
+	// one batch warms the pool up, after that nothing should reach the heap
+	for (size_t i = 0; i < batch; i++)
+		live.push_back(pool.Make<PingMessage>());
+	live.clear();
+	size_t pooled = run("pool", [&pool]() { return pool.Make<PingMessage>(); });
+
+	// the same under load, messages made on this thread and released by the miners
+	// the message line drops each broadcast once every miner has read it, so a few blocks warm the pool up
+	constexpr size_t warmup = 64;
+	MessagePool::Stats warm;
+	MessagePool::Stats end;
+	{
+		ProcessManager pm(5);
+		pm.AddMessageHandler(typeid(PingMessage),
+			[](ProcessManager::MsgPtr, const ProcessManager::MinerContext&)
+			{
+				return std::optional<Block>(Block());
+			}
+		);
+		for (size_t i = 0; i < messages / 100 + warmup; i++)
+		{
+			pm.MineBlock(pm.MakeMessage<PingMessage>());
+			if (i + 1 == warmup)
+				warm = pm.GetMessagePoolStats();
+		}
+		end = pm.GetMessagePoolStats();
+	}
+	std::cout << "manager pool: " << warm.fresh << " blocks from the heap while warming up, "
+		<< end.fresh - warm.fresh << " after, " << end.reused - warm.reused << " reused" << std::endl;
+
+	if (pooled != 0)
+		std::cout << "FAILED: the warm pool allocated " << pooled << " times" << std::endl;
+	return pooled == 0;
+}
+
+bool Benchmarks::BlockCopies(size_t blocks)
+{
+	// longer than the small string buffer, so every copy of one of these would allocate
+	const std::string id(40, 'i');
+	const std::string name(40, 'n');
+	const std::string msg(200, 'm');
+	ProcessManager pm(4);
+	pm.AddMessageHandler<HashPuzzle1>(SolveHashPuzzle<HashPuzzle1>);
+	// the whole pipeline, the puzzle goes to the miners, the winner's block to the verifiers and then to its log
+	auto mine = [&pm](const Block& b, size_t i)
+	{
+		return pm.MineBlock(pm.MakeMessage<HashPuzzle1>(b, 100u, unsigned(i)));
+	};
+	// warms the message pools and the logs up
+	for (size_t i = 0; i < 100; i++)
+		mine(Block(id, name, msg), i);
+
+	size_t sink = 0;
+	size_t ingest = 0;
+	size_t copies = 0;
+	size_t caller_allocs = 0;
+	auto start = Clock::now();
+	for (size_t i = 0; i < blocks; i++)
+	{
+		size_t made = Block::PayloadsMade();
+		const Block b(id, name, msg);
+		ingest += Block::PayloadsMade() - made;
+		// payloads are counted on every thread, so this sees copies made by the miners and the coordinator too
+		made = Block::PayloadsMade();
+		const size_t allocs = AllocationCounter::ThreadAllocations();
+		sink ^= mine(b, i);
+		caller_allocs += AllocationCounter::ThreadAllocations() - allocs;
+		copies += Block::PayloadsMade() - made;
+	}
+	double s = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << "ingest: " << double(ingest) / blocks << " string copies/block" << std::endl;
+	std::cout << "puzzle to log: " << double(copies) / blocks << " string copies/block, "
+		<< double(caller_allocs) / blocks << " allocations/block on the calling thread, "
+		<< s * 1e6 / blocks << " us/block" << std::endl;
+	std::cout << "(checksum " << sink << ")" << std::endl;
+	if (copies != 0)
+		std::cout << "FAILED: a block's strings were copied " << copies << " times after ingest" << std::endl;
+	return copies == 0;
+}
+
+bool Benchmarks::HashRate(size_t attempts)
+{
+	const Block block("20K-0481", "Sarim", "Hello");
+	size_t sink = 0;
+
+	// what the handler used to do for every nonce
+	auto start = Clock::now();
+	size_t allocs = AllocationCounter::ThreadAllocations();
+	std::hash<std::string> str_hasher;
+	for (size_t i = 0; i < attempts; i++)
+	{
+		std::ostringstream oss;
+		oss << block.GetMsg() << block.GetOwnerName() << block.GetMsg() << i;
+		sink ^= str_hasher(oss.str());
+	}
+	double legacy_s = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t legacy_allocs = AllocationCounter::ThreadAllocations() - allocs;
+
+	start = Clock::now();
+	allocs = AllocationCounter::ThreadAllocations();
+	Fnv1aMidstate hasher({ block.GetMsg(), block.GetOwnerName(), block.GetMsg() });
+	size_t setup_allocs = AllocationCounter::ThreadAllocations() - allocs;
+	allocs = AllocationCounter::ThreadAllocations();
+	for (size_t i = 0; i < attempts; i++)
+		sink ^= hasher.Hash(i);
+	double midstate_s = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t midstate_allocs = AllocationCounter::ThreadAllocations() - allocs;
+
+	std::cout << "ostringstream + std::hash: " << attempts / legacy_s / 1e6 << " Mhash/s, "
+		<< double(legacy_allocs) / attempts << " allocations per attempt" << std::endl;
+	std::cout << "fnv-1a midstate: " << attempts / midstate_s / 1e6 << " Mhash/s, "
+		<< double(midstate_allocs) / attempts << " allocations per attempt ("
+		<< setup_allocs << " per puzzle)" << std::endl;
+	std::cout << "(checksum " << sink << ")" << std::endl;
+
+	if (midstate_allocs != 0)
+	{
+		std::cout << "FAILED: the midstate loop allocated " << midstate_allocs << " times" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool Benchmarks::Sha256Rate(size_t attempts)
+{
+	typedef Sha256Midstate::Impl Impl;
+	const Block block("20K-0481", "Sarim", "Hello");
+	const size_t batch = Sha256Midstate::maxLanes;
+	attempts -= attempts % batch;
+
+	// known answer first, sha256("abc")
+	const uint8_t abc[4] = { 0xba, 0x78, 0x16, 0xbf };
+	bool ok = true;
+
+	Sha256Midstate reference({ block.GetMsg(), block.GetOwnerName(), block.GetMsg() });
+	reference.SetImpl(Impl::Scalar);
+	std::cout << "best sha-256 implementation: " << Sha256Midstate::GetImplName(Sha256Midstate::BestImpl()) << std::endl;
+
+	for (Impl impl : { Impl::Scalar, Impl::ShaNi, Impl::Sse41, Impl::Avx2, Impl::Avx512 })
+	{
+		if (!Sha256Midstate::Supported(impl))
+		{
+			std::cout << Sha256Midstate::GetImplName(impl) << ": not supported" << std::endl;
+			continue;
+		}
+		Sha256Midstate hasher({ block.GetMsg(), block.GetOwnerName(), block.GetMsg() });
+		hasher.SetImpl(impl);
+
+		auto digest = Sha256Midstate::Digest("abc", impl);
+		if (!std::equal(abc, abc + 4, digest.begin()))
+		{
+			std::cout << "FAILED: " << Sha256Midstate::GetImplName(impl) << " gets sha256(\"abc\") wrong" << std::endl;
+			ok = false;
+		}
+
+		size_t nonces[batch], hashes[batch], expected[batch];
+		size_t sink = 0;
+		auto start = Clock::now();
+		for (size_t first = 0; first < attempts; first += batch)
+		{
+			for (size_t i = 0; i < batch; i++)
+				nonces[i] = first + i;
+			hasher.HashMany(nonces, batch, hashes);
+			sink ^= hashes[0];
+		}
+		double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+		// compare a few batches, including ones where the nonces change length
+		for (size_t first : { size_t(0), size_t(99999990), size_t(123456789012) })
+		{
+			for (size_t i = 0; i < batch; i++)
+				nonces[i] = first + i;
+			hasher.HashMany(nonces, batch, hashes);
+			reference.HashMany(nonces, batch, expected);
+			if (!std::equal(hashes, hashes + batch, expected))
+			{
+				std::cout << "FAILED: " << Sha256Midstate::GetImplName(impl) << " disagrees with the scalar hasher" << std::endl;
+				ok = false;
+			}
+		}
+
+		std::cout << Sha256Midstate::GetImplName(impl) << ": " << attempts / secs / 1e6 << " Mhash/s per core"
+			<< " (checksum " << sink << ")" << std::endl;
+	}
+	return ok;
+}
+
+bool Benchmarks::VerifyRate(size_t hashes)
+{
+	// something hash-like to take remainders of
+	std::vector<uint64_t> values(hashes);
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	for (auto& v : values)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		uint64_t z = x;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		v = z ^ (z >> 31);
+	}
+	values[0] = 0;
+	values[1] = ~uint64_t(0);
+
+	bool ok = true;
+	for (uint32_t d : { 1u, 2u, 3u, 7u, 10u, 641u, 2100u, 0x7FFFFFFFu, 0x80000001u, 0xFFFFFFFFu })
+	{
+		FastMod mod(d);
+		for (auto v : values)
+		{
+			if (mod.Mod(v) != v % d)
+			{
+				std::cout << "FAILED: " << v << " % " << d << " gave " << mod.Mod(v) << std::endl;
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	// a divisor the compiler cannot see, like modVal
+	const uint32_t divisor = 1 + Random::ThreadRng().Below(2000);
+	const FastMod mod(divisor);
+	size_t sink = 0;
+	auto start = Clock::now();
+	for (auto v : values)
+		sink += (v % divisor) == 42;
+	double div_s = std::chrono::duration<double>(Clock::now() - start).count();
+	start = Clock::now();
+	for (auto v : values)
+		sink += mod.Mod(v) == 42;
+	double fast_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << "hardware modulo: " << hashes / div_s / 1e6 << " M/s" << std::endl;
+	std::cout << "reciprocal modulo: " << hashes / fast_s / 1e6 << " M/s" << std::endl;
+	std::cout << "(checksum " << sink << ")" << std::endl;
+	return ok;
+}
+
+void Benchmarks::RngContention(size_t threads, size_t draws)
+{
+	auto run = [threads, draws](auto draw)
+	{
+		std::atomic<uint64_t> sink = 0;
+		auto start = Clock::now();
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&sink, &draw, draws]()
+				{
+					uint64_t sum = 0;
+					for (size_t i = 0; i < draws; i++)
+						sum += draw();
+					sink += sum;
+				}
+			);
+		}
+		for (auto& w : workers)
+			w.join();
+		double s = std::chrono::duration<double>(Clock::now() - start).count();
+		return std::make_pair(threads * draws / s / 1e6, sink.load());
+	};
+
+	auto [rand_rate, rand_sum] = run([]() { return uint64_t(rand()); });
+	auto [rng_rate, rng_sum] = run([]() { return Random::ThreadRng().Next(); });
+	std::cout << threads << " threads, rand(): " << rand_rate << " M draws/s" << std::endl;
+	std::cout << threads << " threads, xoshiro256** per thread: " << rng_rate << " M draws/s" << std::endl;
+	std::cout << "(checksum " << (rand_sum ^ rng_sum) << ")" << std::endl;
+}
+
+bool Benchmarks::SubmissionOrder(size_t blocks, size_t threads)
+{
+	const Block block("20K-0481", "Sarim", "Hello");
+	// every puzzle is made before any is mined, then submitted newest first from several threads,
+	// so the order the ids were handed out in has nothing to do with the order they are mined in
+	std::vector<std::shared_ptr<HashPuzzle1>> puzzles;
+	for (size_t i = 0; i < blocks; i++)
+		puzzles.push_back(std::make_shared<HashPuzzle1>(block, 2000, unsigned(i)));
+
+	std::atomic<size_t> mined = 0;
+	std::atomic<size_t> failed = 0;
+	auto start = Clock::now();
+	{
+		ProcessManager pm(4);
+		pm.AddMessageHandler<HashPuzzle1>(SolveHashPuzzle<HashPuzzle1>);
+		std::vector<std::thread> submitters;
+		for (size_t t = 0; t < threads; t++)
+		{
+			submitters.emplace_back([&, t]()
+				{
+					for (size_t i = t; i < blocks; i += threads)
+					{
+						auto& puzzle = puzzles[blocks - 1 - i];
+						try
+						{
+							pm.MineBlockAsync(puzzle).get();
+							mined++;
+						}
+						catch (const std::exception& e)
+						{
+							std::cout << "FAILED: puzzle " << puzzle->GetID() << ": " << e.what() << std::endl;
+							failed++;
+						}
+					}
+				}
+			);
+		}
+		for (auto& t : submitters)
+			t.join();
+	}
+	double s = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << mined << " of " << blocks << " puzzles mined out of order from " << threads << " threads in "
+		<< s * 1000 << "ms" << std::endl;
+	return failed == 0;
+}
+
+bool Benchmarks::MiningSweep(size_t blocks, const std::string& format)
+{
+	// one row of the results
+	struct Result
+	{
+		std::string puzzle;
+		// average hashes needed per block
+		size_t difficulty;
+		size_t miners;
+		double hashesPerSecond;
+		double blocksPerSecond;
+		double p50Ms;
+		double p99Ms;
+		// process cpu time over wall time times hardware threads
+		double cpuUtilisation;
+	};
+	// builds the puzzle for the i-th block
+	struct Workload
+	{
+		std::string puzzle;
+		size_t difficulty;
+		std::function<ProcessManager::MsgPtr(const Block&)> make;
+		std::function<bool(const ProcessManager::MsgPtr&, size_t)> solves;
+	};
+
+	blocks = std::max<size_t>(blocks, 1);
+	std::vector<Workload> workloads;
+	for (unsigned int mod_val : { 100u, 1000u, 10000u })
+	{
+		workloads.push_back({ "HashPuzzle1", mod_val,
+			[mod_val](const Block& b) { return std::make_shared<HashPuzzle1>(b, mod_val, 7); },
+			[](const ProcessManager::MsgPtr& m, size_t hash) { return ((HashPuzzle1*)m.get())->Verify(hash); } });
+	}
+	workloads.push_back({ "HashPuzzle2", 10,
+		[](const Block& b) { return MakePuzzle<HashPuzzle2>(b); },
+		[](const ProcessManager::MsgPtr& m, size_t hash) { return ((HashPuzzle2*)m.get())->Verify(hash); } });
+
+	const size_t hardware = std::max<size_t>(1, std::thread::hardware_concurrency());
+	std::vector<size_t> miner_counts;
+	for (size_t n = 1; n < hardware; n *= 2)
+		miner_counts.push_back(n);
+	miner_counts.push_back(hardware);
+
+	bool ok = true;
+	std::vector<Result> results;
+	for (auto& w : workloads)
+	{
+		for (size_t miners : miner_counts)
+		{
+			std::vector<double> latencies;
+			latencies.reserve(blocks);
+			uint64_t hashes = 0;
+			double wall_s, cpu_s;
+			{
+				ProcessManager pm(miners);
+				pm.AddMessageHandler<HashPuzzle1>(SolveHashPuzzle<HashPuzzle1>);
+				pm.AddMessageHandler<HashPuzzle2>(SolveHashPuzzle<HashPuzzle2>);
+
+				const double cpu_start = ProcessCpuSeconds();
+				const auto start = Clock::now();
+				for (size_t i = 0; i < blocks; i++)
+				{
+					auto msg = w.make(Block("BENCH-" + std::to_string(i), "bench", "block " + std::to_string(i)));
+					const auto sent = Clock::now();
+					const size_t hash = pm.MineBlock(msg);
+					latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+					if (!w.solves(msg, hash))
+					{
+						std::cout << "FAILED: " << w.puzzle << " mined a hash that does not solve it" << std::endl;
+						ok = false;
+					}
+				}
+				wall_s = std::chrono::duration<double>(Clock::now() - start).count();
+				cpu_s = ProcessCpuSeconds() - cpu_start;
+				for (auto& st : pm.GetStats())
+					hashes += st.hashes;
+			}
+			std::sort(latencies.begin(), latencies.end());
+			results.push_back({ w.puzzle, w.difficulty, miners, hashes / wall_s, blocks / wall_s,
+				Quantile(latencies, 0.5), Quantile(latencies, 0.99), cpu_s / (wall_s * hardware) });
+		}
+	}
+
+	if (format == "json")
+	{
+		nlohmann::json arr = nlohmann::json::array();
+		for (auto& r : results)
+		{
+			arr.push_back({ { "puzzle", r.puzzle }, { "difficulty", r.difficulty }, { "miners", r.miners },
+				{ "hashes_per_s", r.hashesPerSecond }, { "blocks_per_s", r.blocksPerSecond },
+				{ "p50_ms", r.p50Ms }, { "p99_ms", r.p99Ms }, { "cpu_utilisation", r.cpuUtilisation } });
+		}
+		std::cout << std::setw(4) << arr << std::endl;
+	}
+	else
+	{
+		std::cout << "puzzle,difficulty,miners,hashes_per_s,blocks_per_s,p50_ms,p99_ms,cpu_utilisation" << std::endl;
+		for (auto& r : results)
+		{
+			std::cout << r.puzzle << ',' << r.difficulty << ',' << r.miners << ',' << r.hashesPerSecond << ','
+				<< r.blocksPerSecond << ',' << r.p50Ms << ',' << r.p99Ms << ',' << r.cpuUtilisation << std::endl;
+		}
+	}
+	return ok;
+}
+
+bool Benchmarks::StorageQueries(size_t blocks, size_t num_processes)
+{
+	const size_t owners = 1000;
+	const size_t warm_runs = 5;
+	const std::string target = "OWN-42";
+	// the benchmarks share a scratch directory and the ones that mine leave their miners' stores behind
+	for (size_t pid = 1; pid <= num_processes; pid++)
+	{
+		std::filesystem::remove("process-" + std::to_string(pid) + ".blocks");
+		std::filesystem::remove("process-" + std::to_string(pid) + ".idx");
+		std::filesystem::remove(JsonFilename(pid));
+	}
+	auto make_record = [num_processes](size_t i)
+	{
+		BlockRecord r;
+		r.block = Block("OWN-" + std::to_string(i % owners), "owner " + std::to_string(i % owners),
+			"synthetic block number " + std::to_string(i), size_t(i * 0x9E3779B97F4A7C15ULL), i, time_t(1600000000 + i));
+		r.miner = 1 + i % num_processes;
+		r.verifiedBy = num_processes - 1;
+		r.totalMiners = num_processes;
+		return r;
+	};
+	size_t expected = 0;
+	for (size_t i = 0; i < blocks; i++)
+		expected += i % owners == 42;
+
+	bool ok = true;
+	auto check = [&ok](const char* format, const char* query, size_t got, size_t want)
+	{
+		if (got != want)
+		{
+			std::cout << "FAILED: " << format << " " << query << " returned " << got << " blocks, expected " << want << std::endl;
+			ok = false;
+		}
+	};
+	auto print = [blocks, owners](const char* format, double append_s, uint64_t bytes, double cold_scan_ms, double warm_scan_ms,
+		double cold_select_ms, double warm_select_ms)
+	{
+		const double mb = bytes / (1024.0 * 1024.0);
+		std::cout << format << ": " << mb << " MB on disk, append " << blocks / append_s << " blocks/s (" << mb / append_s << " MB/s)" << std::endl;
+		std::cout << format << ": full scan cold " << cold_scan_ms << "ms, warm " << warm_scan_ms << "ms ("
+			<< blocks / (warm_scan_ms / 1000.0) << " blocks/s, " << mb / (warm_scan_ms / 1000.0) << " MB/s)" << std::endl;
+		std::cout << format << ": ownerID query (1 in " << owners << " blocks) cold " << cold_select_ms << "ms, warm " << warm_select_ms << "ms" << std::endl;
+	};
+
+	// the text format, written and scanned the way the miners used to
+	{
+		auto start = Clock::now();
+		for (size_t i = 0; i < blocks; i++)
+		{
+			auto r = make_record(i);
+			JsonAppend(JsonFilename(r.miner), r.GetJSON());
+		}
+		const double append_s = std::chrono::duration<double>(Clock::now() - start).count();
+		uint64_t bytes = 0;
+		for (size_t pid = 1; pid <= num_processes; pid++)
+			bytes += FileBytes(JsonFilename(pid));
+
+		auto scan = [num_processes](auto pred)
+		{
+			nlohmann::json arr = nlohmann::json::array();
+			for (size_t pid = 1; pid <= num_processes; pid++)
+			{
+				auto data = JsonScan(JsonFilename(pid), pred);
+				arr.insert(arr.end(), data.begin(), data.end());
+			}
+			return arr;
+		};
+		auto all = [](const nlohmann::json&) { return true; };
+		auto owner = [&target](const nlohmann::json& j) { return j["ownerID"] == target; };
+		size_t scanned = 0, selected = 0;
+		const double cold_scan = MedianMs(1, [&]() { scanned = scan(all).size(); });
+		const double warm_scan = MedianMs(warm_runs, [&]() { scan(all); });
+		const double cold_select = MedianMs(1, [&]() { selected = scan(owner).size(); });
+		const double warm_select = MedianMs(warm_runs, [&]() { scan(owner); });
+		check("json", "full scan", scanned, blocks);
+		check("json", "ownerID query", selected, expected);
+		print("json text", append_s, bytes, cold_scan, warm_scan, cold_select, warm_select);
+	}
+
+	// the binary log, filled through SaveBlock
+	{
+		double append_s;
+		{
+			ProcessManager pm(num_processes);
+			auto start = Clock::now();
+			for (size_t i = 0; i < blocks; i++)
+			{
+				auto r = make_record(i);
+				pm.SaveBlock(r.miner, r);
+			}
+			pm.FlushStorage();
+			append_s = std::chrono::duration<double>(Clock::now() - start).count();
+		}
+		uint64_t bytes = 0;
+		for (size_t pid = 1; pid <= num_processes; pid++)
+			bytes += FileBytes("process-" + std::to_string(pid) + ".blocks");
+
+		// a new manager so the first queries open the logs and load the indexes from disk
+		auto start = Clock::now();
+		ProcessManager pm(num_processes);
+		const double open_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		auto all = [](const BlockView&) { return true; };
+		auto owner = [&target](const BlockView& b) { return b.ownerID == target; };
+		size_t scanned = 0, selected = 0, indexed = 0, streamed = 0;
+		const double cold_scan = MedianMs(1, [&]() { scanned = pm.GetBlocks(all).size(); });
+		const double warm_scan = MedianMs(warm_runs, [&]() { pm.GetBlocks(all); });
+		const double cold_select = MedianMs(1, [&]() { selected = pm.GetBlocks(owner).size(); });
+		const double warm_select = MedianMs(warm_runs, [&]() { pm.GetBlocks(owner); });
+		const double index_ms = MedianMs(warm_runs, [&]() { indexed = pm.GetBlocksByOwner(target).size(); });
+		const double stream_ms = MedianMs(warm_runs, [&]()
+			{
+				streamed = 0;
+				pm.ForEachBlock(all, [&streamed](const BlockView&) { streamed++; });
+			}
+		);
+		check("binary", "full scan", scanned, blocks);
+		check("binary", "ownerID query", selected, expected);
+		check("binary", "ownerID index lookup", indexed, expected);
+		check("binary", "ForEachBlock", streamed, blocks);
+		print("binary log", append_s, bytes, cold_scan, warm_scan, cold_select, warm_select);
+		std::cout << "binary log: opening the stores " << open_ms << "ms, ownerID index lookup " << index_ms
+			<< "ms, ForEachBlock over every block without json " << stream_ms << "ms ("
+			<< blocks / (stream_ms / 1000.0) << " blocks/s)" << std::endl;
+	}
+	return ok;
+}
+
+bool Benchmarks::StorageWrites(size_t blocks, size_t threads)
+{
+	const std::pair<BlockLog::Durability, const char*> policies[] = {
+		{ BlockLog::Durability::None, "none" },
+		{ BlockLog::Durability::SyncPerBatch, "sync per batch" },
+		{ BlockLog::Durability::SyncPerBlock, "sync per block" }
+	};
+	bool ok = true;
+	for (auto& [policy, name] : policies)
+	{
+		const std::string filename = std::string("bench-") + std::to_string(int(policy)) + ".blocks";
+		size_t read = 0;
+		BlockLog::Stats stats;
+		double seconds;
+		{
+			BlockLog log(filename);
+			log.SetDurability(policy);
+			auto start = Clock::now();
+			std::vector<std::thread> appenders;
+			for (size_t t = 0; t < threads; t++)
+			{
+				appenders.emplace_back([&log, blocks, threads, t]()
+					{
+						BlockRecord r;
+						for (size_t i = t; i < blocks; i += threads)
+						{
+							r.block = Block("20K-0481", "bench", "block " + std::to_string(i), i, i, 0);
+							log.Append(r);
+						}
+					}
+				);
+			}
+			for (auto& a : appenders)
+				a.join();
+			log.Flush();
+			seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			stats = log.GetStats();
+			log.ForEachView([&read](const BlockView&) { read++; });
+		}
+		std::cout << name << ": " << blocks / seconds << " blocks/s, " << stats.writes << " writes, "
+			<< stats.syncs << " syncs, " << double(stats.blocks) / stats.batches << " blocks per batch, write amplification "
+			<< stats.WriteAmplification() << std::endl;
+		if (read != blocks)
+		{
+			std::cout << name << ": wrote " << blocks << " blocks but read back " << read << std::endl;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+bool Benchmarks::Run(int argc, char** argv)
+{
+	std::string name = argc > 2 ? argv[2] : "all";
+	bool known = false;
+	bool ok = true;
+	Random::SetRunSeed(1);
+	InScratchDirectory([&]()
+		{
+			if (name == "dispatch" || name == "all")
+			{
+				known = true;
+				size_t miners = argc > 3 && name != "all" ? std::stoul(argv[3]) : 5;
+				size_t iterations = argc > 4 && name != "all" ? std::stoul(argv[4]) : 2000;
+				DispatchLatency(miners, iterations);
+			}
+			if (name == "messages" || name == "all")
+			{
+				known = true;
+				size_t messages = argc > 3 && name != "all" ? std::stoul(argv[3]) : 1000000;
+				ok = MessageAllocations(messages) && ok;
+			}
+			if (name == "blocks" || name == "all")
+			{
+				known = true;
+				size_t blocks = argc > 3 && name != "all" ? std::stoul(argv[3]) : 2000;
+				ok = BlockCopies(blocks) && ok;
+			}
+			if (name == "hashing" || name == "all")
+			{
+				known = true;
+				size_t attempts = argc > 3 && name != "all" ? std::stoul(argv[3]) : 5000000;
+				ok = HashRate(attempts) && ok;
+			}
+			if (name == "sha256" || name == "all")
+			{
+				known = true;
+				size_t attempts = argc > 3 && name != "all" ? std::stoul(argv[3]) : 2000000;
+				ok = Sha256Rate(attempts) && ok;
+			}
+			if (name == "verify" || name == "all")
+			{
+				known = true;
+				size_t hashes = argc > 3 && name != "all" ? std::stoul(argv[3]) : 10000000;
+				ok = VerifyRate(hashes) && ok;
+			}
+			if (name == "rng" || name == "all")
+			{
+				known = true;
+				size_t threads = argc > 3 && name != "all" ? std::stoul(argv[3]) : 32;
+				size_t draws = argc > 4 && name != "all" ? std::stoul(argv[4]) : 1000000;
+				RngContention(threads, draws);
+			}
+			if (name == "order" || name == "all")
+			{
+				known = true;
+				size_t blocks = argc > 3 && name != "all" ? std::stoul(argv[3]) : 200;
+				size_t threads = argc > 4 && name != "all" ? std::stoul(argv[4]) : 4;
+				ok = SubmissionOrder(blocks, threads) && ok;
+			}
+			if (name == "mining" || name == "all")
+			{
+				known = true;
+				size_t blocks = argc > 3 && name != "all" ? std::stoul(argv[3]) : 50;
+				std::string format = argc > 4 && name != "all" ? argv[4] : "csv";
+				ok = MiningSweep(blocks, format) && ok;
+			}
+			if (name == "store" || name == "all")
+			{
+				known = true;
+				size_t blocks = argc > 3 && name != "all" ? std::stoul(argv[3]) : 100000;
+				size_t miners = argc > 4 && name != "all" ? std::stoul(argv[4]) : 5;
+				ok = StorageQueries(blocks, miners) && ok;
+			}
+			if (name == "storage" || name == "all")
+			{
+				known = true;
+				size_t blocks = argc > 3 && name != "all" ? std::stoul(argv[3]) : 2000;
+				size_t threads = argc > 4 && name != "all" ? std::stoul(argv[4]) : 4;
+				ok = StorageWrites(blocks, threads) && ok;
+			}
+		}
+	);
+	if (!known)
+		std::cout << "unknown benchmark: " << name << std::endl;
+	return known && ok;
+}
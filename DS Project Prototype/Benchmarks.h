@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// benchmarks for the process manager, run with "--bench <name> [args...]"
+// they run inside a temporary directory so they do not touch the real miner files
+// and with a fixed run seed so runs can be compared
+namespace Benchmarks
+{
+	// measures the time from a message being broadcast to the first handler starting on it
+	void DispatchLatency(size_t num_processes, size_t iterations);
+	// makes and drops messages with make_shared and with the message pool and counts the allocations,
+	// then checks how many pool blocks still come from the heap once a busy manager has warmed up
+	// returns false if the warm pool allocated
+	bool MessageAllocations(size_t messages);
+	// mines blocks with strings too long for the small string buffer through a real ProcessManager
+	// and counts the copies of their strings made on any thread after the block was read in
+	// returns false if any hop copied the strings
+	bool BlockCopies(size_t blocks);
+	// compares the hash rate of building the whole input per attempt with the midstate hasher
+	// returns false if the midstate loop allocated
+	bool HashRate(size_t attempts);
+	// hash rate of every SHA-256 implementation the cpu supports on one core
+	// returns false if any of them disagrees with the scalar one
+	bool Sha256Rate(size_t attempts);
+	// compares a hardware modulo by a runtime divisor with the precomputed reciprocal HashPuzzle1 uses
+	// returns false if they disagree on any of the hashes
+	bool VerifyRate(size_t hashes);
+	// draws random numbers from many threads at once with rand() and with the per-thread generators
+	void RngContention(size_t threads, size_t draws);
+	// appends blocks to a log from several threads under each durability policy and reports
+	// throughput, writes, syncs and write amplification, returns false if a block went missing
+	bool StorageWrites(size_t blocks, size_t threads);
+	// fills the miners' stores through SaveBlock in the old json text format and in the binary log
+	// and compares append throughput, full scans, a selective query and cold against warm queries
+	// returns false if the formats disagree on what the queries return
+	bool StorageQueries(size_t blocks, size_t num_processes);
+	// mines blocks with both puzzles at several difficulties for 1 miner up to one per hardware thread
+	// and prints hashes/s, blocks/s, p50/p99 MineBlock latency and cpu utilisation as csv or json
+	// returns false if a mined hash does not solve its puzzle
+	bool MiningSweep(size_t blocks, const std::string& format);
+	// makes every puzzle up front and mines them in the reverse order from several threads
+	// returns false if any of them failed to be mined
+	bool SubmissionOrder(size_t blocks, size_t threads);
+
+	// runs the benchmark named on the command line
+	// returns false if the name is not known or a benchmark's check failed
+	bool Run(int argc, char** argv);
+}
@@ -1,12 +1,42 @@
 #include "Block.h"
+#include <atomic>
 #include <iostream>
 
+namespace
+{
+	// only bumped when a block is read in, so it is not worth a counter per thread
+	std::atomic<size_t> payloadsMade = 0;
+}
+
+Block::Payload::Payload(std::string ownerID, std::string ownerName, std::string msg)
+	:
+	ownerID(std::move(ownerID)),
+	ownerName(std::move(ownerName)),
+	msg(std::move(msg))
+{
+	payloadsMade.fetch_add(1, std::memory_order_relaxed);
+}
+
+Block::Payload::Payload(const Payload& other)
+	:
+	ownerID(other.ownerID),
+	ownerName(other.ownerName),
+	msg(other.msg)
+{
+	payloadsMade.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t Block::PayloadsMade()
+{
+	return payloadsMade.load(std::memory_order_relaxed);
+}
+
 nlohmann::json Block::GetJSON() const
 {
 	nlohmann::json block;
-	block["ownerID"] = ownerID;
-	block["ownerName"] = ownerName;
-	block["msg"] = msg;
+	block["ownerID"] = payload->ownerID;
+	block["ownerName"] = payload->ownerName;
+	block["msg"] = payload->msg;
 	block["hash"] = hash;
 	block["nonce"] = nonce;
 	char temp[255];
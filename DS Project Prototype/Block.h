@@ -1,15 +1,41 @@
 #pragma once
 #include "nlohmann.h"
+#include <memory>
+#include <string>
 
+// the strings of a block are made once when it is read in and shared by every copy after that,
+// so passing a block through the mining pipeline copies a pointer instead of three strings
 class Block
 {
+	// never changed once made, copies of a block may live on several threads
+	struct Payload
+	{
+		Payload() = default;
+		// these two are the only ways the strings end up in a payload, both are counted for PayloadsMade
+		Payload(std::string ownerID, std::string ownerName, std::string msg);
+		Payload(const Payload& other);
+
+		std::string ownerID;
+		std::string ownerName;
+		std::string msg;
+	};
+
 public:
-	Block() = default;
+	Block()
+		:
+		payload(EmptyPayload())
+	{}
 	Block(std::string ownerID, std::string ownerName, std::string msg)
 		:
-		ownerID(ownerID),
-		ownerName(ownerName),
-		msg(msg)
+		payload(std::make_shared<const Payload>(std::move(ownerID), std::move(ownerName), std::move(msg)))
+	{}
+	// used when reading back a block that was already mined
+	Block(std::string ownerID, std::string ownerName, std::string msg, size_t hash, size_t nonce, time_t timestamp)
+		:
+		payload(std::make_shared<const Payload>(std::move(ownerID), std::move(ownerName), std::move(msg))),
+		hash(hash),
+		nonce(nonce),
+		timestamp(timestamp)
 	{}
 	// returns a JSON object constructed from the block
 	nlohmann::json GetJSON() const;
@@ -18,14 +44,14 @@ public:
 	{
 		nlohmann::json block;
 		in >> block;
-		ownerID = block["ownerID"];
-		ownerName = block["ownerName"];
-		msg = block["msg"];
+		payload = std::make_shared<const Payload>(block["ownerID"].get<std::string>(), block["ownerName"].get<std::string>(), block["msg"].get<std::string>());
 	}
 	// read regular input from an inpu stream
 	friend std::istream& operator>>(std::istream& in, Block& b)
 	{
-		in >> b.ownerID >> b.ownerName >> b.msg;
+		std::string owner_id, owner_name, msg;
+		in >> owner_id >> owner_name >> msg;
+		b.payload = std::make_shared<const Payload>(std::move(owner_id), std::move(owner_name), std::move(msg));
 		return in;
 	}
 	// print block in json format
@@ -35,17 +61,17 @@ public:
 		return out;
 	}
 
-	std::string GetOwnerID() const
+	const std::string& GetOwnerID() const
 	{
-		return ownerID;
+		return payload->ownerID;
 	}
-	std::string GetOwnerName() const
+	const std::string& GetOwnerName() const
 	{
-		return ownerName;
+		return payload->ownerName;
 	}
-	std::string GetMsg() const
+	const std::string& GetMsg() const
 	{
-		return msg;
+		return payload->msg;
 	}
 	size_t GetHash() const
 	{
@@ -55,6 +81,14 @@ public:
 	{
 		return nonce;
 	}
+	time_t GetTimestamp() const
+	{
+		return timestamp;
+	}
+
+	// payloads made from strings or copied by any thread since the program started
+	// copying a block shares its payload, so the benchmarks use this to check the mining pipeline never copies strings
+	static size_t PayloadsMade();
 
 	void UpdateMiningInfo(size_t res_hash, size_t res_nonce)
 	{
@@ -66,9 +100,15 @@ public:
 	}
 
 private:
-	std::string ownerID;
-	std::string ownerName;
-	std::string msg;
+	// shared by every default constructed block so making one does not allocate
+	static const std::shared_ptr<const Payload>& EmptyPayload()
+	{
+		static const std::shared_ptr<const Payload> empty = std::make_shared<const Payload>();
+		return empty;
+	}
+
+private:
+	std::shared_ptr<const Payload> payload;
 	size_t hash = 0;
 	size_t nonce = 0;
 	time_t timestamp = 0;
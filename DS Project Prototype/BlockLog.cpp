@@ -0,0 +1,386 @@
+#include "BlockLog.h"
+#include <cstring>
+#include <filesystem>
+#include <intrin.h>
+#include <nmmintrin.h>
+
+namespace
+{
+	const char logMagic[8] = { 'D', 'S', 'B', 'L', 'K', 'L', 'O', 'G' };
+	// anything longer than this is treated as a corrupt length prefix
+	const uint32_t maxRecordLength = 64 * 1024 * 1024;
+
+	// table for the reflected castagnoli polynomial
+	struct Crc32cTable
+	{
+		uint32_t entries[256];
+		Crc32cTable()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t crc = i;
+				for (int j = 0; j < 8; j++)
+					crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+				entries[i] = crc;
+			}
+		}
+	};
+
+	bool ValidFileHeader(const char* data, size_t size)
+	{
+		BlockLog::FileHeader header;
+		if (size < sizeof(header))
+			return false;
+		std::memcpy(&header, data, sizeof(header));
+		return std::memcmp(header.magic, logMagic, sizeof(logMagic)) == 0
+			&& header.version == BlockLog::version
+			&& header.headerSize == sizeof(header);
+	}
+
+	bool FieldInBounds(uint32_t offset, uint32_t length, size_t payload_size)
+	{
+		return size_t(offset) + length <= payload_size;
+	}
+
+	// true if an intact record starts anywhere after pos, which tells damage in the middle of a log from a torn tail
+	bool IntactRecordAfter(const char* data, size_t size, size_t pos)
+	{
+		BlockView v;
+		for (pos++; pos < size; pos++)
+		{
+			if (BlockLog::DecodeView(data + pos, size - pos, v) != 0)
+				return true;
+		}
+		return false;
+	}
+
+	// the crc32 instruction computes crc32c, so use it when the cpu has sse4.2
+	bool HasCrc32Instruction()
+	{
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+	}
+
+	uint32_t Crc32cHardware(const unsigned char* p, size_t len, uint32_t crc)
+	{
+#ifdef _M_X64
+		uint64_t crc64 = crc;
+		for (; len >= 8; len -= 8, p += 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, p, sizeof(word));
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+		crc = uint32_t(crc64);
+#else
+		// the 64 bit form of the instruction only exists on x64
+		for (; len >= 4; len -= 4, p += 4)
+		{
+			uint32_t word;
+			std::memcpy(&word, p, sizeof(word));
+			crc = _mm_crc32_u32(crc, word);
+		}
+#endif
+		for (; len > 0; len--, p++)
+			crc = _mm_crc32_u8(crc, *p);
+		return crc;
+	}
+}
+
+nlohmann::json BlockRecord::GetJSON() const
+{
+	auto j = block.GetJSON();
+	j["verified-by"] = verifiedBy;
+	j["total miners"] = totalMiners;
+	j["miner"] = miner;
+	return j;
+}
+
+BlockRecord BlockView::ToRecord() const
+{
+	BlockRecord r;
+	r.block = Block(std::string(ownerID), std::string(ownerName), std::string(msg),
+		size_t(hash), size_t(nonce), time_t(timestamp));
+	r.miner = miner;
+	r.verifiedBy = verifiedBy;
+	r.totalMiners = totalMiners;
+	return r;
+}
+
+nlohmann::json BlockView::GetJSON() const
+{
+	return ToRecord().GetJSON();
+}
+
+BlockLog::BlockLog(std::string filename)
+	:
+	filename(std::move(filename))
+{
+	std::error_code ec;
+	if (std::filesystem::file_size(this->filename, ec) > 0 && !ec)
+	{
+		// drop a record that was only partly written, or the ones appended after it would never be read
+		// (this also throws if the file is not a block log of this version)
+		size_t end, size;
+		{
+			MappedFile file(this->filename);
+			auto skip = [](const BlockView&, uint64_t, uint32_t) {};
+			end = Walk(file, skip);
+			size = file.GetSize();
+			// only a torn last record may be cut, a damaged one with intact records after it is left alone
+			if (end < size && IntactRecordAfter(file.GetData(), size, end))
+				throw std::exception("Block log has a damaged record before intact ones");
+		}
+		if (end < size)
+			std::filesystem::resize_file(this->filename, end);
+		this->size = end;
+		out.emplace(this->filename, false);
+	}
+	else
+	{
+		// new log, start it with the file header
+		out.emplace(this->filename, true);
+		FileHeader header;
+		std::memcpy(header.magic, logMagic, sizeof(logMagic));
+		header.version = version;
+		header.headerSize = sizeof(header);
+		out->Write((const char*)&header, sizeof(header));
+		size = sizeof(header);
+		stats.bytesWritten += sizeof(header);
+		stats.writes++;
+	}
+	writer = std::thread([this]() { func(); });
+}
+
+BlockLog::~BlockLog()
+{
+	{
+		std::lock_guard<std::mutex> g(mtx);
+		stopping = true;
+	}
+	queuedCv.notify_all();
+	writer.join();
+}
+
+BlockLog::Location BlockLog::Append(const BlockRecord& r)
+{
+	std::unique_lock<std::mutex> lk(mtx);
+	if (error)
+		std::rethrow_exception(error);
+	const size_t start = queue.size();
+	Encode(r, queue);
+	queueEnds.push_back(queue.size());
+	Location loc;
+	loc.offset = size;
+	loc.size = uint32_t(queue.size() - start);
+	size += loc.size;
+	const uint64_t n = ++queued;
+	stats.blocks++;
+	// everything but the length prefix and the crc
+	stats.payloadBytes += queue.size() - start - 2 * sizeof(uint32_t);
+	queuedCv.notify_one();
+
+	if (durability != Durability::None)
+	{
+		writtenCv.wait(lk, [this, n]() { return synced >= n || error; });
+		if (error)
+			std::rethrow_exception(error);
+	}
+	return loc;
+}
+
+void BlockLog::Flush() const
+{
+	std::unique_lock<std::mutex> lk(mtx);
+	const uint64_t n = queued;
+	writtenCv.wait(lk, [this, n]() { return written >= n || error; });
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void BlockLog::SetDurability(Durability d)
+{
+	std::lock_guard<std::mutex> g(mtx);
+	durability = d;
+}
+
+BlockLog::Stats BlockLog::GetStats() const
+{
+	std::lock_guard<std::mutex> g(mtx);
+	return stats;
+}
+
+void BlockLog::func()
+{
+	std::string batch;
+	std::vector<size_t> ends;
+	while (true)
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		queuedCv.wait(lk, [this]() { return stopping || !queue.empty(); });
+		// whatever was queued before closing still gets written
+		if (queue.empty())
+			return;
+		batch.swap(queue);
+		ends.swap(queueEnds);
+		queue.clear();
+		queueEnds.clear();
+		const Durability d = durability;
+		// number of the first record in the batch
+		const uint64_t first = queued - ends.size() + 1;
+		lk.unlock();
+
+		try
+		{
+			if (d == Durability::SyncPerBlock)
+			{
+				size_t pos = 0;
+				for (size_t i = 0; i < ends.size(); i++)
+				{
+					out->Write(batch.data() + pos, ends[i] - pos);
+					out->Sync();
+					pos = ends[i];
+					std::lock_guard<std::mutex> g(mtx);
+					written = synced = first + i;
+					stats.writes++;
+					stats.syncs++;
+					writtenCv.notify_all();
+				}
+			}
+			else
+			{
+				out->Write(batch.data(), batch.size());
+				if (d == Durability::SyncPerBatch)
+					out->Sync();
+				std::lock_guard<std::mutex> g(mtx);
+				written = first + ends.size() - 1;
+				stats.writes++;
+				if (d == Durability::SyncPerBatch)
+				{
+					synced = written;
+					stats.syncs++;
+				}
+			}
+			std::lock_guard<std::mutex> g(mtx);
+			stats.bytesWritten += batch.size();
+			stats.batches++;
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> g(mtx);
+			error = std::current_exception();
+		}
+		writtenCv.notify_all();
+	}
+}
+
+void BlockLog::ForEach(const std::function<void(const BlockRecord&)>& f) const
+{
+	ReadFile(filename, f);
+}
+
+const std::string& BlockLog::GetFilename() const
+{
+	return filename;
+}
+
+uint64_t BlockLog::GetSize() const
+{
+	std::lock_guard<std::mutex> g(mtx);
+	return size;
+}
+
+void BlockLog::ReadFile(const std::string& filename, const std::function<void(const BlockRecord&)>& f)
+{
+	MappedFile file(filename);
+	auto to_record = [&f](const BlockView& v, uint64_t, uint32_t) { f(v.ToRecord()); };
+	Walk(file, to_record);
+}
+
+void BlockLog::CheckFileHeader(const MappedFile& file)
+{
+	if (!ValidFileHeader(file.GetData(), file.GetSize()))
+		throw std::exception("Not a block log of this version");
+}
+
+size_t BlockLog::DecodeView(const char* data, size_t available, BlockView& v)
+{
+	uint32_t length;
+	if (available < sizeof(length))
+		return 0;
+	std::memcpy(&length, data, sizeof(length));
+	if (length < sizeof(RecordHeader) + sizeof(uint32_t) || length > maxRecordLength || length > available - sizeof(length))
+		return 0;
+
+	const char* record = data + sizeof(length);
+	const size_t body = length - sizeof(uint32_t);
+	uint32_t crc;
+	std::memcpy(&crc, record + body, sizeof(crc));
+	if (crc != Crc32c(record, body))
+		return 0;
+
+	RecordHeader h;
+	std::memcpy(&h, record, sizeof(h));
+	const size_t payload = body - sizeof(RecordHeader);
+	if (!FieldInBounds(h.ownerIDOffset, h.ownerIDLength, payload)
+		|| !FieldInBounds(h.ownerNameOffset, h.ownerNameLength, payload)
+		|| !FieldInBounds(h.msgOffset, h.msgLength, payload))
+		return 0;
+
+	const char* strings = record + sizeof(RecordHeader);
+	v.ownerID = std::string_view(strings + h.ownerIDOffset, h.ownerIDLength);
+	v.ownerName = std::string_view(strings + h.ownerNameOffset, h.ownerNameLength);
+	v.msg = std::string_view(strings + h.msgOffset, h.msgLength);
+	v.hash = h.hash;
+	v.nonce = h.nonce;
+	v.timestamp = h.timestamp;
+	v.miner = h.miner;
+	v.verifiedBy = h.verifiedBy;
+	v.totalMiners = h.totalMiners;
+	return sizeof(length) + length;
+}
+
+void BlockLog::Encode(const BlockRecord& r, std::string& out)
+{
+	const std::string& ownerID = r.block.GetOwnerID();
+	const std::string& ownerName = r.block.GetOwnerName();
+	const std::string& msg = r.block.GetMsg();
+
+	RecordHeader h;
+	h.hash = r.block.GetHash();
+	h.nonce = r.block.GetNonce();
+	h.timestamp = r.block.GetTimestamp();
+	h.miner = uint32_t(r.miner);
+	h.verifiedBy = uint32_t(r.verifiedBy);
+	h.totalMiners = uint32_t(r.totalMiners);
+	h.ownerIDOffset = 0;
+	h.ownerIDLength = uint32_t(ownerID.size());
+	h.ownerNameOffset = h.ownerIDOffset + h.ownerIDLength;
+	h.ownerNameLength = uint32_t(ownerName.size());
+	h.msgOffset = h.ownerNameOffset + h.ownerNameLength;
+	h.msgLength = uint32_t(msg.size());
+
+	const uint32_t length = uint32_t(sizeof(h) + ownerID.size() + ownerName.size() + msg.size() + sizeof(uint32_t));
+	const size_t start = out.size();
+	out.append((const char*)&length, sizeof(length));
+	out.append((const char*)&h, sizeof(h));
+	out.append(ownerID);
+	out.append(ownerName);
+	out.append(msg);
+	const uint32_t crc = Crc32c(out.data() + start + sizeof(length), length - sizeof(uint32_t));
+	out.append((const char*)&crc, sizeof(crc));
+}
+
+uint32_t BlockLog::Crc32c(const void* data, size_t len, uint32_t crc)
+{
+	static const bool hardware = HasCrc32Instruction();
+	static const Crc32cTable table;
+	auto p = (const unsigned char*)data;
+	if (hardware)
+		return ~Crc32cHardware(p, len, ~crc);
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++)
+		crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "nlohmann.h"
+#include "Block.h"
+#include "AppendFile.h"
+#include "MappedFile.h"
+
+// a mined block as it is stored by a miner
+struct BlockRecord
+{
+	Block block;
+	// PID of the miner that found the nonce
+	size_t miner = 0;
+	// number of other miners that agreed with the hash
+	size_t verifiedBy = 0;
+	size_t totalMiners = 0;
+
+	// the json object the miners used to store, also what the export tool prints
+	nlohmann::json GetJSON() const;
+};
+
+// a record read straight out of a mapped log, the strings point into the mapping
+// so it is only valid inside the callback it was passed to
+struct BlockView
+{
+	std::string_view ownerID;
+	std::string_view ownerName;
+	std::string_view msg;
+	uint64_t hash = 0;
+	uint64_t nonce = 0;
+	int64_t timestamp = 0;
+	uint32_t miner = 0;
+	uint32_t verifiedBy = 0;
+	uint32_t totalMiners = 0;
+
+	// copies the view into a record that owns its strings
+	BlockRecord ToRecord() const;
+	nlohmann::json GetJSON() const;
+};
+
+// append-only binary log of the blocks saved by a miner
+// the file starts with a FileHeader, followed by records made of:
+//   uint32 length of everything after it, a RecordHeader, the strings it points at, uint32 crc32c of header and strings
+// a record that is cut short or fails its crc marks the end of the log (a write that never finished),
+// it is cut off when the log is opened as long as no intact record follows it
+// appends are encoded into a buffer and written by the log's own writer thread, everything queued
+// while it was busy goes out in one write (group commit)
+class BlockLog
+{
+public:
+	// when the writer forces what it wrote out to the disk, and so when Append returns
+	enum class Durability
+	{
+		// never, Append returns once the record is queued
+		None,
+		// once after each batch, Append returns once the batch holding the record is on the disk
+		SyncPerBatch,
+		// after every record, written one by one, Append returns once the record is on the disk
+		SyncPerBlock
+	};
+	// what the writer has done so far
+	struct Stats
+	{
+		uint64_t blocks = 0;
+		// bytes of record headers and strings appended, what the blocks themselves take up
+		uint64_t payloadBytes = 0;
+		// bytes actually written to the file, framing and file header included
+		uint64_t bytesWritten = 0;
+		uint64_t writes = 0;
+		uint64_t syncs = 0;
+		uint64_t batches = 0;
+
+		// bytes written per byte of block data
+		double WriteAmplification() const
+		{
+			return payloadBytes ? double(bytesWritten) / payloadBytes : 0.0;
+		}
+	};
+	// where a record was put in the file
+	struct Location
+	{
+		uint64_t offset = 0;
+		// bytes the record takes up, length prefix and crc included
+		uint32_t size = 0;
+	};
+#pragma pack(push, 1)
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+	};
+	struct RecordHeader
+	{
+		uint64_t hash;
+		uint64_t nonce;
+		int64_t timestamp;
+		uint32_t miner;
+		uint32_t verifiedBy;
+		uint32_t totalMiners;
+		// offsets are from the end of the record header
+		uint32_t ownerIDOffset;
+		uint32_t ownerIDLength;
+		uint32_t ownerNameOffset;
+		uint32_t ownerNameLength;
+		uint32_t msgOffset;
+		uint32_t msgLength;
+	};
+#pragma pack(pop)
+	static constexpr uint32_t version = 1;
+
+public:
+	// opens the log for appending, the file and its header are created if it does not exist
+	// throws if the file exists but is not a block log of this version, or if it has a damaged record
+	// that is not the last one (it is left as it is for the export tool or a person to look at)
+	BlockLog(std::string filename);
+	// writes out whatever is still queued and stops the writer
+	~BlockLog();
+	// queues the record for the writer and returns where it will be written
+	// waits for it to be on the disk unless the durability is None
+	// throws if the writer failed to write an earlier record
+	Location Append(const BlockRecord& r);
+	// waits until every record queued so far has been written (not necessarily synced)
+	void Flush() const;
+	// meant to be set before blocks are appended, records already queued keep the old policy
+	void SetDurability(Durability d);
+	Stats GetStats() const;
+	// calls f for every intact record in the order they were appended
+	void ForEach(const std::function<void(const BlockRecord&)>& f) const;
+	// maps the log and calls f with a view of every intact record, nothing is copied
+	// records appended while this runs are not seen
+	template <typename F>
+	void ForEachView(F f) const
+	{
+		Flush();
+		MappedFile file(filename);
+		auto each = [&f](const BlockView& v, uint64_t, uint32_t) { f(v); };
+		Walk(file, each);
+	}
+	// same as ForEachView but starts at the record at offset start
+	// f is also given the offset and size in bytes of each record, if it returns a bool
+	// then false stops the walk after that record
+	// returns the offset of the record after the last one f was called with
+	template <typename F>
+	uint64_t ForEachViewFrom(uint64_t start, F f) const
+	{
+		Flush();
+		MappedFile file(filename);
+		return Walk(file, f, start);
+	}
+	// calls f with a view of the record at each of the given offsets, offsets that
+	// do not point at an intact record are skipped
+	template <typename F>
+	void ForEachViewAt(const std::vector<uint64_t>& offsets, F f) const
+	{
+		Flush();
+		MappedFile file(filename);
+		CheckFileHeader(file);
+		BlockView v;
+		for (auto offset : offsets)
+		{
+			if (offset < file.GetSize() && DecodeView(file.GetData() + offset, file.GetSize() - offset, v))
+				f(v);
+		}
+	}
+	const std::string& GetFilename() const;
+	// bytes taken up by the file header and the intact records, queued ones included
+	uint64_t GetSize() const;
+
+	// same as ForEach, for a log that is not open (used by the export tool)
+	static void ReadFile(const std::string& filename, const std::function<void(const BlockRecord&)>& f);
+	// decodes the record at the start of data into v
+	// returns the number of bytes it takes up, or 0 if it is cut short or damaged
+	static size_t DecodeView(const char* data, size_t available, BlockView& v);
+	// serialises a record exactly as Append writes it, length prefix and crc included
+	static void Encode(const BlockRecord& r, std::string& out);
+	// crc32c (castagnoli) of a buffer
+	static uint32_t Crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+private:
+	// gets called once by the writer thread
+	void func();
+	// checks the file header of a mapped log, throws if it is not a log of this version
+	static void CheckFileHeader(const MappedFile& file);
+	// calls f(view, offset, size) for each record of a mapped log from start up to the first damaged one
+	// or until f returns false, if it returns anything
+	// returns the offset just past the last record f was called with
+	template <typename F>
+	static size_t Walk(const MappedFile& file, F& f, size_t start = sizeof(FileHeader))
+	{
+		CheckFileHeader(file);
+		BlockView v;
+		size_t pos = start < sizeof(FileHeader) ? sizeof(FileHeader) : start;
+		while (pos < file.GetSize())
+		{
+			size_t n = DecodeView(file.GetData() + pos, file.GetSize() - pos, v);
+			if (n == 0)
+				break;
+			const uint64_t offset = pos;
+			pos += n;
+			if constexpr (std::is_same_v<decltype(f(v, offset, uint32_t(n))), bool>)
+			{
+				if (!f(v, offset, uint32_t(n)))
+					break;
+			}
+			else
+				f(v, offset, uint32_t(n));
+		}
+		return pos;
+	}
+
+private:
+	std::string filename;
+	// only touched by the writer once the log is open
+	std::optional<AppendFile> out;
+	// guards everything below
+	mutable std::mutex mtx;
+	// signalled when a record is queued or the log is closing
+	std::condition_variable queuedCv;
+	// signalled when the writer has written or synced a batch
+	mutable std::condition_variable writtenCv;
+	// encoded records waiting for the writer, and where each of them ends in it
+	std::string queue;
+	std::vector<size_t> queueEnds;
+	// records are numbered in the order they are queued
+	uint64_t queued = 0;
+	uint64_t written = 0;
+	uint64_t synced = 0;
+	// end of the last intact record, where the next one is appended
+	uint64_t size = 0;
+	Durability durability = Durability::None;
+	Stats stats;
+	// set if the writer failed, every later append and flush rethrows it
+	std::exception_ptr error;
+	bool stopping = false;
+	std::thread writer;
+};
@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+// bounded single producer / multi consumer broadcast queue
+// every reader owns a cursor and sees every item pushed after it joined,
+// a slot is only reused once the slowest reader has moved past it
+// the last reader to copy an item out of its slot drops it, so the ring does not keep items alive
+// (a reader removed before reading an item leaves it in its slot until the slot is reused)
+// reads and pushes never lock, the producer only scans the cursors when the ring looks full
+// readers have to be added on the producer's thread (or before it starts pushing)
+template <typename T>
+class BroadcastRing
+{
+	// padded to a cache line so readers do not false share their cursors
+	struct alignas(64) Cursor
+	{
+		std::atomic<size_t> pos = 0;
+		std::atomic<bool> active = false;
+	};
+	struct Slot
+	{
+		T item;
+		// readers that have not copied the item yet
+		std::atomic<size_t> unread = 0;
+	};
+public:
+	// capacity is rounded up to a power of two
+	BroadcastRing(size_t capacity, size_t max_readers)
+		:
+		slots(RoundUpPow2(capacity)),
+		mask(slots.size() - 1),
+		cursors(max_readers)
+	{}
+	BroadcastRing(const BroadcastRing&) = delete;
+	BroadcastRing& operator=(const BroadcastRing&) = delete;
+
+	// registers a new reader, it will see every item pushed from now on
+	// returns the id the reader must pass to TryRead
+	// must be called by the producer, a push running at the same time could not see the new cursor
+	size_t AddReader()
+	{
+		std::lock_guard<std::mutex> g(readersMtx);
+		for (size_t i = 0; i < cursors.size(); i++)
+		{
+			if (!cursors[i].active.load())
+			{
+				cursors[i].pos.store(head.load());
+				cursors[i].active.store(true);
+				readerCount.fetch_add(1);
+				return i;
+			}
+		}
+		throw std::exception("Too many readers registered on the broadcast ring");
+	}
+	// releases a reader's cursor, slots it had not read yet may be reused
+	void RemoveReader(size_t reader)
+	{
+		std::lock_guard<std::mutex> g(readersMtx);
+		cursors[reader].active.store(false);
+		readerCount.fetch_sub(1);
+	}
+	// publishes an item to all readers, must only be called by the producer
+	// returns false if the slowest reader is a full lap behind and nothing was pushed
+	bool TryPush(T item)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		// cursors only move forward and new ones start at the head, so an old minimum is never too high
+		if (h - minCursor >= slots.size())
+		{
+			minCursor = MinCursor(h);
+			if (h - minCursor >= slots.size())
+				return false;
+		}
+		// every reader counted here is at or behind h, readers added later start past it
+		const size_t readers = readerCount.load(std::memory_order_acquire);
+		Slot& s = slots[h & mask];
+		if (readers != 0)
+			s.item = std::move(item);
+		s.unread.store(readers, std::memory_order_relaxed);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	// copies the next unread item for the given reader and advances its cursor
+	// must only be called by the thread owning the reader id
+	bool TryRead(size_t reader, T& out)
+	{
+		Cursor& c = cursors[reader];
+		const size_t pos = c.pos.load(std::memory_order_relaxed);
+		if (pos == head.load(std::memory_order_acquire))
+			return false;
+		Slot& s = slots[pos & mask];
+		out = s.item;
+		// dropped before the cursor moves on, so the producer never reuses a slot that is still being cleared
+		if (s.unread.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			s.item = T();
+		c.pos.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	// number of items the slowest reader has not read yet
+	size_t Depth() const
+	{
+		const size_t h = head.load(std::memory_order_acquire);
+		return h - MinCursor(h);
+	}
+	// true once every reader has read everything pushed so far
+	bool Empty() const
+	{
+		return Depth() == 0;
+	}
+
+private:
+	size_t MinCursor(size_t h) const
+	{
+		size_t m = h;
+		for (auto& c : cursors)
+		{
+			if (c.active.load(std::memory_order_acquire))
+				m = std::min(m, c.pos.load(std::memory_order_acquire));
+		}
+		return m;
+	}
+	static size_t RoundUpPow2(size_t n)
+	{
+		size_t p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+private:
+	std::vector<Slot> slots;
+	const size_t mask;
+	std::vector<Cursor> cursors;
+	alignas(64) std::atomic<size_t> head = 0;
+	// slowest cursor as of the last scan, only touched by the producer
+	size_t minCursor = 0;
+	// serialises adding and removing readers
+	std::mutex readersMtx;
+	// active readers, what each pushed item starts its unread count at
+	std::atomic<size_t> readerCount = 0;
+};
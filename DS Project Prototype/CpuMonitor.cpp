@@ -0,0 +1,46 @@
+#include "CpuMonitor.h"
+#define NOMINMAX
+#include <Windows.h>
+#include <algorithm>
+
+namespace
+{
+	uint64_t Ticks(const FILETIME& t)
+	{
+		return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+	}
+
+	// reads the machine's idle and total time and this process's time, false if either call failed
+	bool ReadTimes(uint64_t& idle, uint64_t& total, uint64_t& own)
+	{
+		FILETIME sysIdle, sysKernel, sysUser;
+		FILETIME creation, exit, kernel, user;
+		if (!GetSystemTimes(&sysIdle, &sysKernel, &sysUser)
+			|| !GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+			return false;
+		idle = Ticks(sysIdle);
+		// the system's kernel time includes its idle time
+		total = Ticks(sysKernel) + Ticks(sysUser);
+		own = Ticks(kernel) + Ticks(user);
+		return true;
+	}
+}
+
+CpuMonitor::CpuMonitor()
+{
+	ReadTimes(lastIdle, lastTotal, lastOwn);
+}
+
+double CpuMonitor::SampleOthersBusy()
+{
+	uint64_t idle, total, own;
+	if (!ReadTimes(idle, total, own) || total <= lastTotal)
+		return 0.0;
+	const double elapsed = double(total - lastTotal);
+	const double busy = double(total - lastTotal - std::min(idle - lastIdle, total - lastTotal)) / elapsed;
+	const double mine = double(own - lastOwn) / elapsed;
+	lastIdle = idle;
+	lastTotal = total;
+	lastOwn = own;
+	return std::clamp(busy - mine, 0.0, 1.0);
+}
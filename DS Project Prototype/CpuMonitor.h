@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+// how much of the machine's cpu other processes are using, measured between calls
+// used to give cores back when the box is shared with other services
+class CpuMonitor
+{
+public:
+	// the first sample covers the time since the monitor was made
+	CpuMonitor();
+	// fraction of all cores' time since the last call that went to other processes, 0 to 1
+	double SampleOthersBusy();
+
+private:
+	// all in 100ns units, summed over every core
+	uint64_t lastIdle = 0;
+	uint64_t lastTotal = 0;
+	uint64_t lastOwn = 0;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// remainder of 64 bit numbers by a 32 bit divisor that is only known at runtime
+// a fixed point reciprocal of the divisor is worked out once (Granlund & Montgomery, fig 4.1)
+// so every remainder is two multiplies, a subtract and shifts instead of a hardware division
+// the same sequence works for every divisor, 1 included, so there are no branches
+class FastMod
+{
+public:
+	// divisor must not be 0
+	FastMod(uint32_t divisor = 1)
+		:
+		d(divisor)
+	{
+		// l = ceil(log2(d))
+		uint32_t l = 0;
+		while (l < 32 && (uint64_t(1) << l) < d)
+			l++;
+		// m = floor(2^64 * (2^l - d) / d) + 1, done as two 32 bit long division steps
+		// since 2^l - d < d the quotient fits in 64 bits
+		const uint64_t a = (uint64_t(1) << l) - d;
+		const uint64_t hi = (a << 32) / d;
+		const uint64_t rem = (a << 32) % d;
+		const uint64_t lo = (rem << 32) / d;
+		m = ((hi << 32) | lo) + 1;
+		sh1 = l < 1 ? l : 1;
+		sh2 = l < 1 ? 0 : l - 1;
+	}
+	uint64_t Div(uint64_t n) const
+	{
+		const uint64_t t = MulHi(m, n);
+		return (t + ((n - t) >> sh1)) >> sh2;
+	}
+	uint64_t Mod(uint64_t n) const
+	{
+		return n - Div(n) * d;
+	}
+	uint32_t GetDivisor() const
+	{
+		return d;
+	}
+
+private:
+	// high 64 bits of the 128 bit product
+	static uint64_t MulHi(uint64_t a, uint64_t b)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		return __umulh(a, b);
+#elif defined(__SIZEOF_INT128__)
+		return uint64_t((unsigned __int128)a * b >> 64);
+#else
+		const uint64_t a_lo = uint32_t(a), a_hi = a >> 32;
+		const uint64_t b_lo = uint32_t(b), b_hi = b >> 32;
+		const uint64_t lo_lo = a_lo * b_lo;
+		const uint64_t hi_lo = a_hi * b_lo;
+		const uint64_t lo_hi = a_lo * b_hi;
+		const uint64_t cross = (lo_lo >> 32) + uint32_t(hi_lo) + lo_hi;
+		return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+	}
+
+private:
+	uint64_t m;
+	uint32_t d;
+	uint32_t sh1;
+	uint32_t sh2;
+};
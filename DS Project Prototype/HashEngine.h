@@ -0,0 +1,48 @@
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <initializer_list>
+#include <string_view>
+
+// FNV-1a, the function MSVC uses for std::hash<std::string>, so hashes match the ones mined before
+// the state over the constant prefix of a block is computed once per puzzle and every attempt
+// only hashes the nonce, written into a stack buffer, so the hot loop never allocates
+class Fnv1aMidstate
+{
+public:
+	// hashes the given pieces one after another as if they were concatenated
+	Fnv1aMidstate(std::initializer_list<std::string_view> prefix)
+	{
+		for (auto& piece : prefix)
+			state = Append(state, piece.data(), piece.size());
+	}
+	// hash of the prefix followed by the nonce in decimal
+	size_t Hash(size_t nonce) const
+	{
+		char buf[24];
+		auto end = std::to_chars(buf, buf + sizeof(buf), nonce).ptr;
+		return Append(state, buf, end - buf);
+	}
+	// hashes n nonces into out, same interface as the SHA-256 hasher
+	void HashMany(const size_t* nonces, size_t n, size_t* out) const
+	{
+		for (size_t i = 0; i < n; i++)
+			out[i] = Hash(nonces[i]);
+	}
+
+private:
+	static size_t Append(size_t h, const char* data, size_t len)
+	{
+		for (size_t i = 0; i < len; i++)
+		{
+			h ^= static_cast<unsigned char>(data[i]);
+			h *= prime;
+		}
+		return h;
+	}
+
+private:
+	static constexpr size_t offsetBasis = sizeof(size_t) == 8 ? size_t(14695981039346656037ULL) : size_t(2166136261U);
+	static constexpr size_t prime = sizeof(size_t) == 8 ? size_t(1099511628211ULL) : size_t(16777619U);
+	size_t state = offsetBasis;
+};
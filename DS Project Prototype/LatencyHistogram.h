@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// set to 0 in the preprocessor definitions to compile the MineBlock phase timing out
+#ifndef DS_PHASE_TIMING
+#define DS_PHASE_TIMING 1
+#endif
+
+// steady clock time in nanoseconds for phase timing, always 0 when it is compiled out
+// so the timing code around it folds away
+inline int64_t PhaseNow()
+{
+#if DS_PHASE_TIMING
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	return 0;
+#endif
+}
+
+// log-linear histogram of durations in nanoseconds in the style of HdrHistogram
+// values are grouped by their power of two and each group is split into subBuckets equal steps,
+// so every value is kept to within 1/subBuckets (about 3%) of itself however large it is
+// recording is a few instructions and lock free, any thread can record or read at any time
+class LatencyHistogram
+{
+public:
+	static constexpr int subBucketBits = 5;
+	static constexpr uint64_t subBuckets = uint64_t(1) << subBucketBits;
+
+public:
+	LatencyHistogram()
+	{
+		Reset();
+	}
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	// negative durations (a clock that went backwards) count as 0
+	void Record(int64_t ns)
+	{
+		const uint64_t v = ns < 0 ? 0 : uint64_t(ns);
+		counts[BucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(v, std::memory_order_relaxed);
+		uint64_t prev = max.load(std::memory_order_relaxed);
+		while (prev < v && !max.compare_exchange_weak(prev, v, std::memory_order_relaxed))
+			;
+	}
+	uint64_t GetCount() const
+	{
+		return count.load(std::memory_order_relaxed);
+	}
+	uint64_t GetMax() const
+	{
+		return max.load(std::memory_order_relaxed);
+	}
+	double GetMean() const
+	{
+		const uint64_t n = GetCount();
+		return n ? double(sum.load(std::memory_order_relaxed)) / n : 0.0;
+	}
+	// the value below which a fraction q of the recorded values fall, to the precision of the buckets
+	uint64_t ValueAt(double q) const
+	{
+		const uint64_t n = GetCount();
+		if (n == 0)
+			return 0;
+		uint64_t rank = uint64_t(q * n);
+		if (rank >= n)
+			rank = n - 1;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < numBuckets; i++)
+		{
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen > rank)
+			{
+				// the top of the bucket, but never more than anything actually recorded
+				const uint64_t upper = BucketUpper(i);
+				return upper < GetMax() ? upper : GetMax();
+			}
+		}
+		return GetMax();
+	}
+	void Reset()
+	{
+		for (auto& c : counts)
+			c.store(0, std::memory_order_relaxed);
+		count = 0;
+		sum = 0;
+		max = 0;
+	}
+
+private:
+	// values below subBuckets get a bucket each, after that every power of two gets subBuckets of them
+	static size_t BucketIndex(uint64_t v)
+	{
+		if (v < subBuckets)
+			return size_t(v);
+		const int e = HighBit(v);
+		const int shift = e - subBucketBits;
+		const uint64_t sub = (v >> shift) - subBuckets;
+		return size_t(subBuckets + uint64_t(shift) * subBuckets + sub);
+	}
+	// largest value that falls in the bucket
+	static uint64_t BucketUpper(size_t index)
+	{
+		if (index < subBuckets)
+			return index;
+		const uint64_t shift = (index - subBuckets) / subBuckets;
+		const uint64_t sub = (index - subBuckets) % subBuckets;
+		return ((subBuckets + sub) << shift) + ((uint64_t(1) << shift) - 1);
+	}
+	// position of the highest set bit, v must not be 0
+	static int HighBit(uint64_t v)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long i;
+		_BitScanReverse64(&i, v);
+		return int(i);
+#elif defined(__GNUC__)
+		return 63 - __builtin_clzll(v);
+#else
+		int i = 0;
+		while (v >>= 1)
+			i++;
+		return i;
+#endif
+	}
+
+private:
+	static constexpr size_t numBuckets = size_t(subBuckets + (64 - subBucketBits) * subBuckets);
+	std::atomic<uint64_t> counts[numBuckets];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+};
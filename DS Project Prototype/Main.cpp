@@ -3,57 +3,81 @@
 #include "ProcessManager.h"
 #include "ProcessMessages.h"
 #include "Block.h"
+#include "Benchmarks.h"
 #include <unordered_map>
 
-int main(void)
+int main(int argc, char** argv)
 {
-	srand(time(0));
-	ProcessManager pm(5);
-
-	pm.AddMessageHandler(typeid(HashPuzzle1), 
-		[](ProcessManager::MsgPtr puzzle_in)
+	if (argc > 1 && std::string(argv[1]) == "--bench")
+		return Benchmarks::Run(argc, argv) ? 0 : 1;
+	// prints the blocks in the given miner logs as json
+	if (argc > 1 && std::string(argv[1]) == "--export")
+	{
+		for (int i = 2; i < argc; i++)
 		{
-			auto puzzle = (HashPuzzle1*)puzzle_in.get();
-			auto block = puzzle->GetBlock();
-			size_t res;
-			std::hash<std::string> str_hasher;
-			
-			size_t i = 0; // nonce
-			while (true)
-			{
-				std::ostringstream oss;
-				oss << block.GetMsg() << block.GetOwnerName() << block.GetMsg() << i;
-
-				res = str_hasher(oss.str());
-				if (puzzle->Verify(res))
-					break;
-				i = rand();
-			}
-			block.UpdateMiningInfo(res, i);
-			return block;
+			BlockLog::ReadFile(argv[i], [](const BlockRecord& r)
+				{
+					std::cout << std::setw(4) << r.GetJSON() << std::endl;
+				}
+			);
 		}
-	);
+		return 0;
+	}
+
+	// "--seed <n>" repeats the puzzles of an earlier run
+	// "--trace <file>" writes a chrome trace of every message to file on exit
+	uint64_t seed = uint64_t(time(0));
+	std::string traceFile;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (std::string(argv[i]) == "--seed")
+			seed = std::stoull(argv[i + 1]);
+		else if (std::string(argv[i]) == "--trace")
+			traceFile = argv[i + 1];
+	}
+	Random::SetRunSeed(seed);
+	std::cout << "run seed: " << seed << std::endl;
+	ProcessManager pm(5);
+	if (!traceFile.empty())
+		pm.EnableTracing(traceFile);
+
+	pm.AddMessageHandler<HashPuzzle1>(SolveHashPuzzle<HashPuzzle1>);
+	pm.AddMessageHandler<HashPuzzle2>(SolveHashPuzzle<HashPuzzle2>);
 
 	Block b;
 	std::ifstream in("Input.txt");
-	size_t hash = 0;
+	// the next block is parsed while the previous ones are mined and saved
+	std::vector<std::shared_ptr<HashPuzzle1>> puzzles;
+	std::vector<std::future<size_t>> hashes;
 	while (in.peek() != EOF)
 	{
 		b.ReadFromJSON(in);
-		hash = pm.MineBlock(MakePuzzle<HashPuzzle1>(b));
+		puzzles.push_back(MakePuzzle<HashPuzzle1>(pm, b));
+		hashes.push_back(pm.MineBlockAsync(puzzles.back()));
 	}
 
-	auto blocks = pm.GetBlocks(
-		[](const nlohmann::json& j)
-		{
-			return j["ownerID"] == "20K-0481";
-		}
-	);
+	size_t leased = 0, hashed = 0, duplicates = 0;
+	for (size_t i = 0; i < puzzles.size(); i++)
+	{
+		hashes[i].get();
+		leased += puzzles[i]->GetNonceSpace().GetLeasedCount();
+		hashed += puzzles[i]->GetNonceSpace().GetHashedCount();
+		duplicates += puzzles[i]->GetNonceSpace().GetDuplicateCount();
+	}
+
+	auto blocks = pm.GetBlocksByOwner("20K-0481");
 
 	for (auto& b : blocks)
 	{
 		std::cout << std::setw(4) << b << std::endl;
 	}
+	std::cout << "nonces leased: " << leased << ", hashed: " << hashed << ", duplicate nonces: " << duplicates
+		<< " (" << (hashed ? 100.0 * duplicates / hashed : 0.0) << "%)" << std::endl;
+	auto storage = pm.GetStorageStats();
+	std::cout << "blocks saved: " << storage.blocks << ", writes: " << storage.writes << ", syncs: " << storage.syncs
+		<< ", write amplification: " << storage.WriteAmplification() << std::endl;
+	pm.WriteStats(std::cout);
+	pm.WritePhaseLatencies(std::cout);
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "MappedFile.h"
+#include <Windows.h>
+#include <cstdint>
+#include <exception>
+
+MappedFile::MappedFile(const std::string& filename)
+{
+	// shared with the miner's writer, which keeps appending while readers have the file mapped
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::exception("Could not open file for mapping");
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		throw std::exception("Could not get the size of a mapped file");
+	}
+	// a 32 bit build cannot map a file that does not fit in its address space
+	if (uint64_t(file_size.QuadPart) > SIZE_MAX)
+	{
+		CloseHandle(file);
+		throw std::exception("File is too large to map in this build");
+	}
+	size = size_t(file_size.QuadPart);
+	// windows refuses to map empty files
+	if (size == 0)
+	{
+		CloseHandle(file);
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		throw std::exception("Could not create file mapping");
+	// the view keeps the mapping alive, so the handle can go straight away
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		throw std::exception("Could not map file");
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		UnmapViewOfFile(data);
+}
+
+const char* MappedFile::GetData() const
+{
+	return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return size;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// read only view of a whole file mapped into memory
+// the mapping reflects the file as it was when it was opened, appends made later are not visible
+class MappedFile
+{
+public:
+	// throws if the file cannot be opened or mapped, an empty file maps to an empty view
+	MappedFile(const std::string& filename);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* GetData() const;
+	size_t GetSize() const;
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+
+// recycles the memory of messages so making one after warmup does not touch the heap
+// std::allocate_shared puts a message and its reference counts in one block, the pool hands those blocks
+// out from free lists sorted by size and takes them back when the last reference to the message goes
+// the free lists stay alive until the pool and every message made from it are gone, so a message may outlive its pool
+class MessagePool
+{
+	// blocks are rounded up to a multiple of this, larger ones than the last class skip the pool
+	static constexpr size_t classSize = 64;
+	static constexpr size_t numClasses = 16;
+
+	// a block on a free list, the link lives in the block itself so freeing never allocates
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	// the free lists, deleted by whoever drops the last reference to them, the pool or the last live block
+	struct Shared
+	{
+		~Shared()
+		{
+			for (auto head : free)
+			{
+				while (head)
+				{
+					FreeBlock* next = head->next;
+					::operator delete(head);
+					head = next;
+				}
+			}
+		}
+		void* Allocate(size_t size)
+		{
+			const size_t c = (size + classSize - 1) / classSize;
+			if (c > numClasses)
+				return ::operator new(size);
+			{
+				std::lock_guard<std::mutex> g(mtx);
+				refs++;
+				if (FreeBlock* b = free[c - 1])
+				{
+					free[c - 1] = b->next;
+					reused++;
+					return b;
+				}
+				fresh++;
+			}
+			return ::operator new(c * classSize);
+		}
+		void Deallocate(void* p, size_t size)
+		{
+			const size_t c = (size + classSize - 1) / classSize;
+			if (c > numClasses)
+			{
+				::operator delete(p);
+				return;
+			}
+			bool last;
+			{
+				std::lock_guard<std::mutex> g(mtx);
+				auto b = static_cast<FreeBlock*>(p);
+				b->next = free[c - 1];
+				free[c - 1] = b;
+				last = --refs == 0;
+			}
+			if (last)
+				delete this;
+		}
+		// called by the pool when it is destroyed
+		void Release()
+		{
+			bool last;
+			{
+				std::lock_guard<std::mutex> g(mtx);
+				last = --refs == 0;
+			}
+			if (last)
+				delete this;
+		}
+
+		std::mutex mtx;
+		// everything below is guarded by mtx
+		FreeBlock* free[numClasses] = {};
+		// the pool itself plus every pooled block in use
+		size_t refs = 1;
+		// blocks taken from a free list
+		uint64_t reused = 0;
+		// blocks that had to come from the heap
+		uint64_t fresh = 0;
+	};
+
+public:
+	// what the pool has handed out since it was made
+	struct Stats
+	{
+		// blocks that came from the heap, this stops growing once the pool has warmed up
+		uint64_t fresh = 0;
+		// blocks that were recycled
+		uint64_t reused = 0;
+	};
+
+	// std allocator over the pool's free lists, only meant for allocate_shared
+	template <typename T>
+	class Allocator
+	{
+	public:
+		typedef T value_type;
+
+	public:
+		Allocator(Shared* shared)
+			:
+			shared(shared)
+		{}
+		template <typename U>
+		Allocator(const Allocator<U>& other)
+			:
+			shared(other.shared)
+		{}
+		T* allocate(size_t n)
+		{
+			static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "pooled types cannot be over aligned");
+			return static_cast<T*>(shared->Allocate(n * sizeof(T)));
+		}
+		void deallocate(T* p, size_t n)
+		{
+			shared->Deallocate(p, n * sizeof(T));
+		}
+		template <typename U>
+		bool operator==(const Allocator<U>& other) const
+		{
+			return shared == other.shared;
+		}
+		template <typename U>
+		bool operator!=(const Allocator<U>& other) const
+		{
+			return shared != other.shared;
+		}
+
+	private:
+		template <typename U>
+		friend class Allocator;
+		Shared* shared;
+	};
+
+public:
+	MessagePool()
+		:
+		shared(new Shared)
+	{}
+	~MessagePool()
+	{
+		shared->Release();
+	}
+	MessagePool(const MessagePool&) = delete;
+	MessagePool& operator=(const MessagePool&) = delete;
+
+	// makes a T in a recycled block, safe to call from any thread
+	template <typename T, typename... Args>
+	std::shared_ptr<T> Make(Args&&... args)
+	{
+		return std::allocate_shared<T>(Allocator<T>(shared), std::forward<Args>(args)...);
+	}
+	Stats GetStats() const
+	{
+		std::lock_guard<std::mutex> g(shared->mtx);
+		return { shared->fresh, shared->reused };
+	}
+
+private:
+	Shared* shared;
+};
@@ -0,0 +1,154 @@
+#include "OwnerIndex.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+	const char indexMagic[8] = { 'D', 'S', 'O', 'W', 'N', 'I', 'D', 'X' };
+
+	uint32_t EntryCrc(const OwnerIndex::Entry& e)
+	{
+		return BlockLog::Crc32c(&e, offsetof(OwnerIndex::Entry, crc));
+	}
+}
+
+OwnerIndex::OwnerIndex(std::string filename, const BlockLog& log)
+	:
+	filename(std::move(filename))
+{
+	if (!Load(log))
+		Rebuild(log);
+	if (!out)
+		throw std::exception("Could not open owner index");
+}
+
+void OwnerIndex::Add(std::string_view owner_id, uint64_t offset, uint32_t size)
+{
+	std::lock_guard<std::mutex> g(mtx);
+	buffer.clear();
+	Insert(HashOwner(owner_id), offset, size);
+	out.write(buffer.data(), buffer.size());
+}
+
+void OwnerIndex::Flush()
+{
+	std::lock_guard<std::mutex> g(mtx);
+	out.flush();
+}
+
+std::vector<uint64_t> OwnerIndex::Find(std::string_view owner_id) const
+{
+	std::lock_guard<std::mutex> g(mtx);
+	auto it = offsets.find(HashOwner(owner_id));
+	if (it == offsets.end())
+		return {};
+	return it->second;
+}
+
+bool OwnerIndex::WasRebuilt() const
+{
+	return rebuilt;
+}
+
+bool OwnerIndex::Load(const BlockLog& log)
+{
+	std::error_code ec;
+	const auto file_size = std::filesystem::file_size(filename, ec);
+	if (ec || file_size < sizeof(FileHeader))
+		return false;
+
+	size_t end = sizeof(FileHeader);
+	covered = sizeof(BlockLog::FileHeader);
+	{
+		MappedFile file(filename);
+		FileHeader header;
+		std::memcpy(&header, file.GetData(), sizeof(header));
+		if (std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) != 0
+			|| header.version != version || header.headerSize != sizeof(header))
+			return false;
+
+		// entries have to follow each other through the log, the first one that does not
+		// (or fails its crc) is where a write was cut short
+		Entry e;
+		for (; end + sizeof(e) <= file.GetSize(); end += sizeof(e))
+		{
+			std::memcpy(&e, file.GetData() + end, sizeof(e));
+			if (e.crc != EntryCrc(e) || e.offset != covered || e.size == 0)
+				break;
+			offsets[e.ownerHash].push_back(e.offset);
+			covered += e.size;
+		}
+	}
+	// the log was cut back past what the index covers, the offsets cannot be trusted
+	if (covered > log.GetSize())
+	{
+		offsets.clear();
+		return false;
+	}
+
+	if (end < file_size)
+		std::filesystem::resize_file(filename, end);
+	out.open(filename, std::ios::binary | std::ios::app);
+	// blocks saved after the index was last written
+	if (covered < log.GetSize())
+		CatchUp(log, covered);
+	return true;
+}
+
+void OwnerIndex::Rebuild(const BlockLog& log)
+{
+	rebuilt = true;
+	offsets.clear();
+	covered = sizeof(BlockLog::FileHeader);
+
+	out.open(filename, std::ios::binary | std::ios::trunc);
+	FileHeader header;
+	std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+	header.version = version;
+	header.headerSize = sizeof(header);
+	out.write((const char*)&header, sizeof(header));
+	CatchUp(log, covered);
+}
+
+void OwnerIndex::CatchUp(const BlockLog& log, uint64_t start)
+{
+	buffer.clear();
+	log.ForEachViewFrom(start, [this](const BlockView& v, uint64_t offset, uint32_t size)
+		{
+			Insert(HashOwner(v.ownerID), offset, size);
+		}
+	);
+	out.write(buffer.data(), buffer.size());
+	out.flush();
+}
+
+void OwnerIndex::Insert(uint64_t owner_hash, uint64_t offset, uint32_t size)
+{
+	Entry e;
+	e.ownerHash = owner_hash;
+	e.offset = offset;
+	e.size = size;
+	e.crc = EntryCrc(e);
+	buffer.append((const char*)&e, sizeof(e));
+	// saves on several threads can add their entries out of log order, keep each owner's offsets sorted
+	auto& owner = offsets[owner_hash];
+	if (owner.empty() || owner.back() < offset)
+		owner.push_back(offset);
+	else
+		owner.insert(std::upper_bound(owner.begin(), owner.end(), offset), offset);
+	covered = std::max(covered, offset + size);
+}
+
+uint64_t OwnerIndex::HashOwner(std::string_view owner_id)
+{
+	// 64 bit FNV-1a, spelled out so the hashes stored in the file do not depend on the standard library
+	uint64_t h = 14695981039346656037ULL;
+	for (char c : owner_id)
+	{
+		h ^= static_cast<unsigned char>(c);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "BlockLog.h"
+
+// ownerID -> offsets of that owner's records in a miner's block log
+// kept in memory for lookups and mirrored to a file so it does not have to be rebuilt on every start
+// the file is a FileHeader followed by one Entry per record of the log, in log order
+// each entry carries its own crc so a write that never finished only loses the tail
+// if the file is missing, damaged or does not match the log it is rebuilt from the log
+class OwnerIndex
+{
+public:
+#pragma pack(push, 1)
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+	};
+	struct Entry
+	{
+		// hash of the ownerID, different ids can share one
+		uint64_t ownerHash;
+		// where the record starts in the log and how many bytes it takes up
+		uint64_t offset;
+		uint32_t size;
+		// crc32c of the fields above
+		uint32_t crc;
+	};
+#pragma pack(pop)
+	static constexpr uint32_t version = 1;
+
+public:
+	// loads the index of the given log, catching up on records it is missing or rebuilding it if needed
+	OwnerIndex(std::string filename, const BlockLog& log);
+	// records that the block at offset belongs to owner_id, called once the block is in the log
+	// safe to call from several threads, the entry is buffered and reaches the file with later ones or on Flush
+	void Add(std::string_view owner_id, uint64_t offset, uint32_t size);
+	// writes out the entries still buffered
+	// the log is the source of truth, an index file that lags behind it only catches up on the next load
+	void Flush();
+	// offsets of the records that may belong to owner_id in the order they are in the log
+	// the records still have to be checked since ids can collide
+	std::vector<uint64_t> Find(std::string_view owner_id) const;
+	// true if the file on disk could not be used and was rebuilt from the log
+	bool WasRebuilt() const;
+
+private:
+	// reads the index file and indexes any records of the log it is missing
+	// returns false if the file cannot be used and has to be rebuilt
+	bool Load(const BlockLog& log);
+	// rewrites the file from scratch by walking the whole log
+	void Rebuild(const BlockLog& log);
+	// indexes every record of the log from offset start with a single write to the file
+	void CatchUp(const BlockLog& log, uint64_t start);
+	// adds the entry to the in-memory map and appends it to buffer for writing
+	void Insert(uint64_t owner_hash, uint64_t offset, uint32_t size);
+	static uint64_t HashOwner(std::string_view owner_id);
+
+private:
+	std::string filename;
+	std::ofstream out;
+	// guards out, offsets, covered and buffer once the index is loaded, blocks can be saved to one miner
+	// from several threads and Find runs on whoever is querying
+	// two saves can add their entries in the opposite order to their records, the next load then
+	// stops at the first one out of order and indexes the log again from there
+	mutable std::mutex mtx;
+	std::unordered_map<uint64_t, std::vector<uint64_t>> offsets;
+	// offset just past the last record of the log that has been indexed
+	uint64_t covered = 0;
+	bool rebuilt = false;
+	// reused between adds
+	std::string buffer;
+};
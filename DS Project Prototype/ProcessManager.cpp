@@ -1,12 +1,26 @@
 #include "ProcessManager.h"
+#include "Trace.h"
+#include "CpuMonitor.h"
 #include <iostream>
+#include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <iomanip>
 
-size_t ProcessManager::Message::count = 0;
-ProcessManager::Message::Message(std::type_index typeID, size_t senderID)
+namespace
+{
+	int64_t SteadyNowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+std::atomic<size_t> ProcessManager::Message::count = 0;
+ProcessManager::Message::Message(std::type_index typeID, size_t senderID, MessageKind kind)
 	:
 	messageTypeID(typeID),
 	senderID(senderID),
+	kind(kind),
 	ID(++count)
 {
 }
@@ -21,40 +35,103 @@ std::type_index ProcessManager::Message::GetMessageTypeID() const
 	return messageTypeID;
 }
 
+ProcessManager::MessageKind ProcessManager::Message::GetKind() const
+{
+	return kind;
+}
+
 size_t ProcessManager::Message::GetSenderID() const
 {
 	return senderID;
 }
 
-std::optional<ProcessManager::Callable> ProcessManager::MessageHandlerMap::GetMessageHandler(const ProcessManager::MsgPtr msg) const
+bool ProcessManager::Message::VerifyBlock(const Block&) const
 {
-	count++;
-	if (num_processes == count)
-	{
-		count = 0;
-		msgLine.pop();
-	}
+	return true;
+}
 
-	if (msg->GetMessageTypeID() == quit_id)
-		return {};
-	
-	auto f = funcMap.find(msg->GetMessageTypeID());
-	if (f != funcMap.end())
-		return f->second;
-	else
-		throw std::exception("Invalid Message typeid received");
+void ProcessManager::Message::StampBroadcast(int64_t ns)
+{
+	broadcastNs.store(ns, std::memory_order_relaxed);
 }
 
-ProcessManager::MessageHandlerMap::MessageHandlerMap(std::queue<std::shared_ptr<Message>>& msgLine, std::type_index quit_id)
+void ProcessManager::Message::StampPickUp(int64_t ns)
+{
+	int64_t expected = 0;
+	pickUpNs.compare_exchange_strong(expected, ns, std::memory_order_relaxed);
+}
+
+int64_t ProcessManager::Message::GetBroadcastTime() const
+{
+	return broadcastNs.load(std::memory_order_relaxed);
+}
+
+int64_t ProcessManager::Message::GetPickUpTime() const
+{
+	return pickUpNs.load(std::memory_order_relaxed);
+}
+
+void ProcessManager::Message::Cancel()
+{
+	cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool ProcessManager::Message::Cancelled() const
+{
+	return cancelled.load(std::memory_order_relaxed);
+}
+
+ProcessManager::BlockCursor::BlockCursor(size_t PID, uint64_t offset, bool done)
 	:
-	msgLine(msgLine),
-	quit_id(quit_id)
+	PID(PID),
+	offset(offset),
+	done(done)
+{
+}
+
+bool ProcessManager::BlockCursor::Done() const
 {
+	return done;
 }
 
-void ProcessManager::MessageHandlerMap::SetNumProcesses(size_t num_processes)
+std::string ProcessManager::BlockCursor::GetToken() const
 {
-	this->num_processes = num_processes;
+	if (done)
+		return "end";
+	std::ostringstream oss;
+	oss << PID << ':' << offset;
+	return oss.str();
+}
+
+ProcessManager::BlockCursor ProcessManager::BlockCursor::FromToken(const std::string& token)
+{
+	if (token == "end")
+		return BlockCursor(0, 0, true);
+	std::istringstream iss(token);
+	size_t PID;
+	uint64_t offset;
+	char sep;
+	if (!(iss >> PID >> sep >> offset) || sep != ':' || iss.peek() != EOF)
+		throw std::exception("Invalid block cursor token");
+	return BlockCursor(PID, offset, false);
+}
+
+const ProcessManager::Callable* ProcessManager::MessageHandlerMap::GetMessageHandler(const Message& msg) const
+{
+	const MessageKind kind = msg.GetKind();
+	if (kind == MessageKind::Quit)
+		return nullptr;
+	// compile time kinds are a single array index, the map is only searched for other types
+	// or for a kind whose handler was added by type_index
+	auto& k = kindFuncs[size_t(kind)];
+	if (k)
+		return &k;
+	
+	auto f = funcMap.find(msg.GetMessageTypeID());
+	if (f != funcMap.end())
+		return &f->second;
+	else
+		throw std::exception("Invalid Message typeid received");
 }
 
 void ProcessManager::MessageHandlerMap::AddFunc(std::type_index msg_id, Callable func)
@@ -62,27 +139,76 @@ void ProcessManager::MessageHandlerMap::AddFunc(std::type_index msg_id, Callable
 	funcMap.insert_or_assign(msg_id, std::move(func));
 }
 
-ProcessManager::Miner::Miner(size_t PID, const std::queue<ProcessManager::MsgPtr>& incoming_messages, std::mutex& mtx, std::mutex& wMtx,
-	std::function<std::optional<std::string>(const MsgPtr)> sendMessage, const MessageHandlerMap& msgHandler)
+void ProcessManager::MessageHandlerMap::AddFunc(MessageKind kind, Callable func)
+{
+	// the Dynamic slot stays empty so unknown types always fall through to the map
+	if (kind == MessageKind::Dynamic || kind == MessageKind::Quit)
+		throw std::exception("Message kind cannot have a handler");
+	kindFuncs[size_t(kind)] = std::move(func);
+}
+
+ProcessManager::Miner::Miner(size_t PID, MessageLine& incoming_messages, std::mutex& mtx, std::mutex& wMtx,
+	std::condition_variable& msgCv, std::condition_variable& doneCv,
+	std::function<std::optional<std::string>(const MsgPtr)> sendMessage, const MessageHandlerMap& msgHandler, MessagePool& msgPool)
 	:
+	log(LogFilename(PID)),
+	index(IndexFilename(PID), log),
 	PID(PID),
 	mtx(mtx),
+	msgCv(msgCv),
+	doneCv(doneCv),
 	wMtx(wMtx),
 	incoming_messages(incoming_messages),
+	cursor(incoming_messages.AddReader()),
 	sendMessage(sendMessage),
 	msgHandler(msgHandler),
+	msgPool(msgPool),
 	t([this]() { func(); })
+{
+}
+
+std::string ProcessManager::Miner::LogFilename(size_t PID)
+{
+	std::ostringstream oss;
+	oss << "process-" << PID << ".blocks";
+	return oss.str();
+}
+
+std::string ProcessManager::Miner::IndexFilename(size_t PID)
 {
 	std::ostringstream oss;
-	oss << "process-" << PID << ".txt";
-	filename = oss.str(); // assign a filename to the process
-	std::ofstream(filename, std::ios::app).close(); // make a new file if it does not exist
+	oss << "process-" << PID << ".idx";
+	return oss.str();
 }
 
 ProcessManager::Miner::~Miner()
 {
 	if (t.joinable())
 		t.join();
+	// a retired miner has already given its cursor back, it may belong to another miner by now
+	if (!retiring)
+		incoming_messages.RemoveReader(cursor);
+}
+
+void ProcessManager::Miner::Retire()
+{
+	// under the lock so a miner checking the flag before parking cannot miss the wakeup
+	{
+		std::lock_guard<std::mutex> g(mtx);
+		retiring = true;
+	}
+	msgCv.notify_all();
+}
+
+void ProcessManager::Miner::Restart()
+{
+	// the old thread stops as soon as it sees the flag, if it has not already
+	if (t.joinable())
+		t.join();
+	cursor = incoming_messages.AddReader();
+	s = State::Waiting;
+	retiring = false;
+	t = std::thread([this]() { func(); });
 }
 
 size_t ProcessManager::Miner::GetPID() const
@@ -90,61 +216,246 @@ size_t ProcessManager::Miner::GetPID() const
 	return PID;
 }
 
-void ProcessManager::Miner::SaveBlock(const nlohmann::json& j)
+void ProcessManager::Miner::SaveBlock(const BlockRecord& r)
 {
-	std::ofstream out(filename, std::ios::app);
-	out << std::endl << std::setw(4) << j;
+	const auto loc = log.Append(r);
+	index.Add(r.block.GetOwnerID(), loc.offset, loc.size);
+}
+
+void ProcessManager::Miner::SetDurability(BlockLog::Durability d)
+{
+	log.SetDurability(d);
+}
+
+BlockLog::Stats ProcessManager::Miner::GetStorageStats() const
+{
+	return log.GetStats();
+}
+
+void ProcessManager::Miner::FlushLog()
+{
+	log.Flush();
+	index.Flush();
+}
+
+nlohmann::json ProcessManager::Miner::GetBlocksByOwner(std::string_view owner_id) const
+{
+	nlohmann::json arr = nlohmann::json::array();
+	auto offsets = index.Find(owner_id);
+	if (offsets.empty())
+		return arr;
+
+	try
+	{
+		log.ForEachViewAt(offsets, [&arr, owner_id](const BlockView& v)
+			{
+				// skip records of owners whose ids hash the same
+				if (v.ownerID == owner_id)
+					arr.push_back(v.GetJSON());
+			}
+		);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << PID << ": " << e.what() << std::endl;
+	}
+
+	return arr;
 }
 
 void ProcessManager::Miner::func()
 {
-	size_t prev_msg_id = 0;
+	counters.stateSince = SteadyNowNs();
+	Trace::SetThreadName("miner " + std::to_string(PID));
 	while (true)
 	{
-		std::optional<ProcessManager::Callable> f;
-		if (!incoming_messages.empty())
+		if (retiring)
 		{
-			auto msg = incoming_messages.front();
-			if (msg->GetID() != prev_msg_id && msg->GetSenderID() != PID)
-			{
-				s = State::Running;
-				prev_msg_id = msg->GetID();
-				// temp scope so the lock guard is destroyed 
-				// before the the function is called
+			// the cursor goes first so the manager never waits on a miner that is no longer reading
+			std::lock_guard<std::mutex> g(mtx);
+			incoming_messages.RemoveReader(cursor);
+			SetState(State::Terminated);
+			doneCv.notify_all();
+			return;
+		}
+		MsgPtr msg;
+		// marked as running before reading so the manager never sees
+		// an advanced cursor while the miner still looks idle
+		SetState(State::Running);
+		if (!incoming_messages.TryRead(cursor, msg))
+		{
+			// nothing to read, park until the next broadcast
+			std::unique_lock<std::mutex> lk(mtx);
+			SetState(State::Waiting);
+			doneCv.notify_all();
+			msgCv.wait(lk, [this, &msg]()
 				{
-					std::lock_guard<std::mutex> g(mtx);
-					if (!(f = msgHandler.GetMessageHandler(msg)))
-					{
-						s = State::Terminated;
-						return;
-					}
+					if (retiring)
+						return true;
+					if (!incoming_messages.TryRead(cursor, msg))
+						return false;
+					SetState(State::Running);
+					return true;
 				}
-				auto res = f.value()(msg);
+			);
+			if (!msg)
+				continue;
+		}
+
+		const Callable* f;
+		try
+		{
+			f = msgHandler.GetMessageHandler(*msg);
+		}
+		catch (const std::exception& e)
+		{
+			// no handler for this type, counted like a handler that threw so the miner keeps going
+			counters.exceptions.fetch_add(1, std::memory_order_relaxed);
+			std::cout << PID << ": " << e.what() << std::endl;
+			continue;
+		}
+		if (!f)
+		{
+			std::lock_guard<std::mutex> g(mtx);
+			SetState(State::Terminated);
+			doneCv.notify_all();
+			return;
+		}
+		if (msg->GetSenderID() != PID)
+		{
+#if DS_PHASE_TIMING
+			msg->StampPickUp(PhaseNow());
+#endif
+			Trace::Instant("picked up", msg->GetID());
+			counters.messages.fetch_add(1, std::memory_order_relaxed);
+			try
+			{
+				Trace::Begin("handler", msg->GetID());
+				auto res = (*f)(msg, MinerContext(PID, *msg, counters.hashes, retiring));
+				Trace::End("handler", msg->GetID());
 				if (res)
 				{
+					// a verifier returns the block it agrees with, that is a vote and not a solution
+					if (msg->GetKind() == MessageKind::Verify)
+						counters.verifications.fetch_add(1, std::memory_order_relaxed);
+					else
+						counters.solutions.fetch_add(1, std::memory_order_relaxed);
 					std::lock_guard<std::mutex> g(wMtx);
-					sendMessage(std::make_shared<Response>(PID, res.value()));
+					sendMessage(msgPool.Make<Response>(PID, msg->GetID(), std::move(res.value())));
+					Trace::Instant("response pushed", msg->GetID());
 				}
-				s = State::Waiting;
+			}
+			catch (const std::exception& e)
+			{
+				Trace::End("handler", msg->GetID());
+				// a bad message should not take the miner down with it
+				counters.exceptions.fetch_add(1, std::memory_order_relaxed);
+				std::cout << PID << ": " << e.what() << std::endl;
 			}
 		}
-		Sleep(2);
 	}
 }
 
+void ProcessManager::Miner::SetState(State next)
+{
+	const int64_t now = SteadyNowNs();
+	const int64_t elapsed = now - counters.stateSince.exchange(now, std::memory_order_relaxed);
+	if (s == State::Running)
+		counters.runningNs.fetch_add(elapsed, std::memory_order_relaxed);
+	else if (s == State::Waiting)
+		counters.waitingNs.fetch_add(elapsed, std::memory_order_relaxed);
+	s = next;
+}
+
+ProcessManager::MinerStats ProcessManager::Miner::GetStats() const
+{
+	MinerStats stats;
+	stats.PID = PID;
+	const State current = s;
+	stats.state = current == State::Running ? "running" : current == State::Waiting ? "waiting" : retiring ? "retired" : "terminated";
+	stats.hashes = counters.hashes.load(std::memory_order_relaxed);
+	stats.solutions = counters.solutions.load(std::memory_order_relaxed);
+	stats.verifications = counters.verifications.load(std::memory_order_relaxed);
+	stats.messages = counters.messages.load(std::memory_order_relaxed);
+	stats.exceptions = counters.exceptions.load(std::memory_order_relaxed);
+	int64_t running = counters.runningNs.load(std::memory_order_relaxed);
+	int64_t waiting = counters.waitingNs.load(std::memory_order_relaxed);
+	// the miner may have been in its current state for a while, e.g. a long handler
+	const int64_t since = counters.stateSince.load(std::memory_order_relaxed);
+	if (since != 0)
+	{
+		const int64_t ongoing = SteadyNowNs() - since;
+		if (current == State::Running)
+			running += ongoing;
+		else if (current == State::Waiting)
+			waiting += ongoing;
+	}
+	stats.runningSeconds = running / 1e9;
+	stats.waitingSeconds = waiting / 1e9;
+	return stats;
+}
+
 ProcessManager::ProcessManager(size_t num_processes)
 	:
-	msgHandler(msgLine, std::type_index(typeid(QuitMessage)))
+	msgLine(msgLineCapacity, maxMiners),
+	readers(std::thread::hardware_concurrency() / 2)
 {
 	assert(num_processes != 0);
+	// verifying costs a single hash, so it is never worth cancelling
+	msgHandler.AddFunc(MessageKind::Verify, [](const MsgPtr msg, const MinerContext& ctx) -> std::optional<Block>
+		{
+			auto v = (VerifyMessage*)msg.get();
+			ctx.ReportHashes(1);
+			bool valid;
+			try
+			{
+				valid = v->GetPuzzle()->VerifyBlock(v->GetBlock());
+			}
+			catch (...)
+			{
+				// a verifier that could not check the block does not vouch for it either,
+				// the miner still counts the exception
+				v->Reject();
+				throw;
+			}
+			if (valid)
+				return v->GetBlock();
+			v->Reject();
+			return {};
+		}
+	);
 	AddProcesses(num_processes);
+	coordinator = std::thread([this]() { CoordinatorFunc(); });
 }
 
 ProcessManager::~ProcessManager()
 {
+	StopAutoscaler();
+	StopStatsDump();
+	// finish mining whatever was submitted before shutting the miners down
+	{
+		std::lock_guard<std::mutex> g(jobMtx);
+		stopping = true;
+	}
+	jobCv.notify_all();
+	coordinator.join();
+
 	PostQuitMessage();
 	// wait for all messages to be processed
 	WaitForCompletion();
+
+	if (!traceFile.empty())
+	{
+		Trace::Stop();
+		try
+		{
+			Trace::WriteFile(traceFile);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << e.what() << std::endl;
+		}
+	}
 }
 
 void ProcessManager::AddMessageHandler(std::type_index msg_id, Callable func)
@@ -154,77 +465,420 @@ void ProcessManager::AddMessageHandler(std::type_index msg_id, Callable func)
 
 void ProcessManager::BroadcastMessage(MsgPtr msg)
 {
-	msgLine.push(msg);
+#if DS_PHASE_TIMING
+	msg->StampBroadcast(PhaseNow());
+#endif
+	Trace::Instant("broadcast", msg->GetID());
+	// only blocks if the slowest miner is a full ring behind
+	while (!msgLine.TryPush(msg))
+		std::this_thread::yield();
+	// taking the lock orders the push before any miner's check under it, so no wakeup is lost
+	{
+		std::lock_guard<std::mutex> g(mtx);
+	}
+	msgCv.notify_all();
 }
 
 bool ProcessManager::Completed() const
 {
+	// the cursors must be checked before the states, see Miner::func
+	if (!msgLine.Empty())
+		return false;
+	std::shared_lock<std::shared_mutex> g(minersMtx);
 	for (auto& p : miners)
 	{
 		if (p->Running())
 			return false;
 	}
-	return msgLine.empty();
+	return true;
 }
 
 void ProcessManager::WaitForCompletion() const
 {
-	while (!Completed())
-		Sleep(10);
+	std::unique_lock<std::mutex> lk(mtx);
+	doneCv.wait(lk, [this]() { return Completed(); });
 }
 
 bool ProcessManager::ResponsesAreAvailable() const
 {
+	std::lock_guard<std::mutex> g(wMtx);
 	return !processResults.empty();
 }
 
-ProcessManager::MsgPtr ProcessManager::GetFirstResponse()
+ProcessManager::MsgPtr ProcessManager::WaitForFirstResponse(size_t msg_id)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lk(wMtx);
+			// time out now and then to notice miners that finished without responding
+			resultCv.wait_for(lk, std::chrono::milliseconds(10), [this]() { return !processResults.empty(); });
+			while (!processResults.empty())
+			{
+				auto r = processResults.front();
+				processResults.pop();
+				// traced under the request's id so it lines up with the rest of the message's events
+				const size_t request_id = ((Response*)(r.get()))->GetRequestID();
+				Trace::Instant("response popped", request_id);
+				if (request_id == msg_id)
+					return r;
+			}
+		}
+		std::lock_guard<std::mutex> g(mtx);
+		if (Completed() && !ResponsesAreAvailable())
+			throw std::exception("No miner responded to the message");
+	}
+}
+
+size_t ProcessManager::VerifyBlock(MsgPtr puzzle, const Response& winner, size_t quorum)
 {
-	assert(ResponsesAreAvailable());
-	auto r = processResults.front();
-	processResults.pop();
-	return r;
+	const size_t verifiers = CountActiveMiners() - 1;
+	auto v = msgPool.Make<VerifyMessage>(winner.GetSenderID(), std::move(puzzle), winner.GetBlock());
+	BroadcastMessage(v);
+
+	size_t agreed = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lk(wMtx);
+			// time out now and then to notice rejections, they do not send a response
+			resultCv.wait_for(lk, std::chrono::milliseconds(10), [this]() { return !processResults.empty(); });
+			while (!processResults.empty())
+			{
+				auto r = processResults.front();
+				processResults.pop();
+				const size_t request_id = ((Response*)(r.get()))->GetRequestID();
+				Trace::Instant("response popped", request_id);
+				// late solutions from the losers are dropped here
+				if (request_id == v->GetID())
+					agreed++;
+			}
+		}
+		if (agreed >= quorum)
+			return agreed;
+		if (verifiers - v->GetRejectedCount() < quorum)
+			throw std::exception("Mined block was rejected by the verifiers");
+		// every miner is idle and the quorum was still not reached, e.g. a verifier retired before it got to the block
+		std::lock_guard<std::mutex> g(mtx);
+		if (Completed() && !ResponsesAreAvailable())
+			throw std::exception("Not enough miners verified the mined block");
+	}
 }
 
-void ProcessManager::SaveBlock(size_t PID, nlohmann::json j)
+void ProcessManager::SaveBlock(size_t PID, const BlockRecord& r)
 {
+	std::shared_lock<std::shared_mutex> g(minersMtx);
 	for (auto& p : miners)
 	{
 		if (p->GetPID() == PID)
 		{
-			p->SaveBlock(j);
+			p->SaveBlock(r);
 			break;
 		}
 	}
 }
 
+nlohmann::json ProcessManager::GetBlocksByOwner(std::string_view owner_id) const
+{
+	return QueryMiners([owner_id](const Miner& m) { return m.GetBlocksByOwner(owner_id); });
+}
+
+std::vector<ProcessManager::MinerStats> ProcessManager::GetStats() const
+{
+	std::vector<MinerStats> stats;
+	std::shared_lock<std::shared_mutex> g(minersMtx);
+	stats.reserve(miners.size());
+	for (auto& p : miners)
+		stats.push_back(p->GetStats());
+	return stats;
+}
+
+void ProcessManager::WriteStats(std::ostream& out) const
+{
+	const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(3);
+	for (auto& st : GetStats())
+	{
+		oss << now << " pid=" << st.PID << " state=" << st.state << " hashes=" << st.hashes
+			<< " solutions=" << st.solutions << " verifications=" << st.verifications << " messages=" << st.messages << " exceptions=" << st.exceptions
+			<< " running_s=" << st.runningSeconds << " waiting_s=" << st.waitingSeconds
+			<< " hash_rate=" << st.HashRate() << '\n';
+	}
+	out << oss.str();
+}
+
+void ProcessManager::StartStatsDump(const std::string& filename, std::chrono::milliseconds interval)
+{
+	StopStatsDump();
+	std::ofstream out(filename, std::ios::app);
+	if (!out)
+		throw std::exception("Could not open stats file");
+	statsStopping = false;
+	statsDumper = std::thread([this, interval, out = std::move(out)]() mutable
+		{
+			std::unique_lock<std::mutex> lk(statsMtx);
+			while (!statsCv.wait_for(lk, interval, [this]() { return statsStopping; }))
+			{
+				lk.unlock();
+				WriteStats(out);
+				out.flush();
+				lk.lock();
+			}
+			// one last dump so the file ends with the final numbers
+			lk.unlock();
+			WriteStats(out);
+		}
+	);
+}
+
+void ProcessManager::EnableTracing(const std::string& filename)
+{
+	traceFile = filename;
+	Trace::Start();
+}
+
+void ProcessManager::StopStatsDump()
+{
+	if (!statsDumper.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> g(statsMtx);
+		statsStopping = true;
+	}
+	statsCv.notify_all();
+	statsDumper.join();
+}
+
+void ProcessManager::SetDurability(BlockLog::Durability d)
+{
+	std::shared_lock<std::shared_mutex> g(minersMtx);
+	for (auto& p : miners)
+		p->SetDurability(d);
+}
+
+BlockLog::Stats ProcessManager::GetStorageStats() const
+{
+	BlockLog::Stats total;
+	std::shared_lock<std::shared_mutex> g(minersMtx);
+	for (auto& p : miners)
+	{
+		auto s = p->GetStorageStats();
+		total.blocks += s.blocks;
+		total.payloadBytes += s.payloadBytes;
+		total.bytesWritten += s.bytesWritten;
+		total.writes += s.writes;
+		total.syncs += s.syncs;
+		total.batches += s.batches;
+	}
+	return total;
+}
+
+void ProcessManager::FlushStorage() const
+{
+	std::shared_lock<std::shared_mutex> g(minersMtx);
+	for (auto& p : miners)
+		p->FlushLog();
+}
+
+void ProcessManager::SetMaxReaders(size_t max_readers)
+{
+	assert(max_readers != 0);
+	readers.SetThreadCount(max_readers);
+}
+
 size_t ProcessManager::MineBlock(MsgPtr msg)
 {
-	if (ResponsesAreAvailable())
-		throw std::exception("There were unread responses in the queue when Mineblock was called");
+	return MineBlockAsync(msg).get();
+}
 
-	BroadcastMessage(msg);
-	WaitForCompletion();
+std::future<size_t> ProcessManager::MineBlockAsync(MsgPtr msg)
+{
+	MiningJob job;
+	job.msg = std::move(msg);
+	auto f = job.result.get_future();
+	{
+		std::unique_lock<std::mutex> lk(jobMtx);
+		jobCv.wait(lk, [this]() { return inFlight < maxInFlight; });
+		inFlight++;
+		jobs.push_back(std::move(job));
+	}
+	jobCv.notify_all();
+	return f;
+}
 
-	int verifications = 0;
-	auto f = GetFirstResponse();
-	auto res = ((Response*)(f.get()))->GetBlock();
-	while (ResponsesAreAvailable())
+void ProcessManager::SetMaxInFlight(size_t max_in_flight)
+{
+	assert(max_in_flight != 0);
 	{
-		auto temp = GetFirstResponse();
-		if (res.GetHash() == ((Response*)(temp.get()))->GetBlock().GetHash())
+		std::lock_guard<std::mutex> g(jobMtx);
+		maxInFlight = max_in_flight;
+	}
+	jobCv.notify_all();
+}
+
+void ProcessManager::SetVerificationQuorum(size_t quorum)
+{
+	verificationQuorum = quorum;
+}
+
+void ProcessManager::WaitForPendingBlocks()
+{
+	std::unique_lock<std::mutex> lk(jobMtx);
+	jobCv.wait(lk, [this]() { return inFlight == 0; });
+}
+
+std::optional<ProcessManager::MiningJob> ProcessManager::WaitForJob()
+{
+	std::unique_lock<std::mutex> lk(jobMtx);
+	while (true)
+	{
+		jobCv.wait(lk, [this]() { return !jobs.empty() || stopping || !fleetChanges.empty(); });
+		// an idle coordinator still has to make fleet changes
+		if (fleetChanges.empty())
+			break;
+		lk.unlock();
+		ApplyFleetChanges();
+		lk.lock();
+	}
+	if (jobs.empty())
+		return {};
+	auto job = std::move(jobs.front());
+	jobs.pop_front();
+	return job;
+}
+
+void ProcessManager::CoordinatorFunc()
+{
+	Trace::SetThreadName("coordinator");
+	std::optional<MiningJob> current;
+	while (true)
+	{
+		if (!current)
+		{
+			if (!(current = WaitForJob()))
+				return;
+			BroadcastMessage(current->msg);
+		}
+
+		std::optional<MiningJob> next;
+		try
 		{
-			verifications++; // signifies the number of processes that got the same hash
-			// the hash may be correct even if other processes got a different one
+			auto mined = FinishMining(current->msg);
+			// nothing is being mined, so the fleet can change without a miner dropping out of a puzzle
+			ApplyFleetChanges();
+			// start the miners on the next block before saving this one
+			{
+				std::lock_guard<std::mutex> g(jobMtx);
+				if (!jobs.empty())
+				{
+					next = std::move(jobs.front());
+					jobs.pop_front();
+				}
+			}
+			if (next)
+				BroadcastMessage(next->msg);
+			current->result.set_value(PersistBlock(mined));
+		}
+		catch (...)
+		{
+			current->result.set_exception(std::current_exception());
 		}
+
+		{
+			std::lock_guard<std::mutex> g(jobMtx);
+			inFlight--;
+		}
+		jobCv.notify_all();
+		current = std::move(next);
 	}
+}
 
-	auto block = res.GetJSON();
-	block["verified-by"] = verifications;
-	block["total miners"] = miners.size();
-	block["miner"] = f->GetSenderID();
-	SaveBlock(f->GetSenderID(), block);
-	return block["hash"];
+ProcessManager::MinedBlock ProcessManager::FinishMining(MsgPtr msg)
+{
+	auto f = WaitForFirstResponse(msg->GetID());
+	const int64_t solved = PhaseNow();
+	RecordPhase(Phase::Dispatch, msg->GetBroadcastTime(), msg->GetPickUpTime());
+	RecordPhase(Phase::FirstSolution, msg->GetBroadcastTime(), solved);
+	// the losers abandon their search instead of running to completion
+	msg->Cancel();
+
+	auto& winner = *(Response*)(f.get());
+	const size_t active = CountActiveMiners();
+	const size_t quorum = std::min(verificationQuorum.load(), active - 1);
+	const size_t verifications = quorum != 0 ? VerifyBlock(msg, winner, quorum) : 0;
+	const int64_t verified = PhaseNow();
+	RecordPhase(Phase::Verify, solved, verified);
+
+	BlockRecord record;
+	record.block = winner.GetBlock();
+	record.verifiedBy = verifications;
+	record.totalMiners = active;
+	record.miner = f->GetSenderID();
+	RecordPhase(Phase::Serialise, verified, PhaseNow());
+	return { f->GetSenderID(), std::move(record) };
+}
+
+size_t ProcessManager::PersistBlock(const MinedBlock& mined)
+{
+	const int64_t start = PhaseNow();
+	SaveBlock(mined.PID, mined.record);
+	RecordPhase(Phase::Persist, start, PhaseNow());
+	return mined.record.block.GetHash();
+}
+
+void ProcessManager::RecordPhase(Phase p, int64_t start, int64_t end)
+{
+#if DS_PHASE_TIMING
+	// a message that was never picked up has no stamp
+	if (start != 0 && end != 0)
+		phaseHistograms[size_t(p)].Record(end - start);
+#endif
+}
+
+const LatencyHistogram& ProcessManager::GetPhaseHistogram(Phase p) const
+{
+	return phaseHistograms[size_t(p)];
+}
+
+const char* ProcessManager::GetPhaseName(Phase p)
+{
+	switch (p)
+	{
+	case Phase::Dispatch:
+		return "dispatch";
+	case Phase::FirstSolution:
+		return "first solution";
+	case Phase::Verify:
+		return "verify";
+	case Phase::Serialise:
+		return "serialise";
+	case Phase::Persist:
+		return "persist";
+	default:
+		return "unknown";
+	}
+}
+
+void ProcessManager::WritePhaseLatencies(std::ostream& out) const
+{
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(1);
+	for (size_t i = 0; i < size_t(Phase::Count); i++)
+	{
+		auto& h = phaseHistograms[i];
+		oss << GetPhaseName(Phase(i)) << ": n=" << h.GetCount() << " mean=" << h.GetMean() / 1000.0
+			<< "us p50=" << h.ValueAt(0.5) / 1000.0 << "us p90=" << h.ValueAt(0.9) / 1000.0
+			<< "us p99=" << h.ValueAt(0.99) / 1000.0 << "us p99.9=" << h.ValueAt(0.999) / 1000.0
+			<< "us max=" << h.GetMax() / 1000.0 << "us\n";
+	}
+	out << oss.str();
+}
+
+MessagePool::Stats ProcessManager::GetMessagePoolStats() const
+{
+	return msgPool.GetStats();
 }
 
 void ProcessManager::AddProcess(size_t id)
@@ -234,10 +888,11 @@ void ProcessManager::AddProcess(size_t id)
 		if (msg->GetSenderID() != id) // to prevent accidentally sending messages from dif threads
 			throw std::exception("Incorrect Sender ID");
 		processResults.push(msg);
+		resultCv.notify_all();
 		return std::optional<std::string>();
 	};
-	miners.emplace_back(std::make_unique<Miner>(id, msgLine, mtx, wMtx, std::move(sendMsg), msgHandler));
-	msgHandler.SetNumProcesses(miners.size());
+	std::unique_lock<std::shared_mutex> g(minersMtx);
+	miners.emplace_back(std::make_unique<Miner>(id, msgLine, mtx, wMtx, msgCv, doneCv, std::move(sendMsg), msgHandler, msgPool));
 }
 
 void ProcessManager::AddProcesses(size_t num_processes)
@@ -246,7 +901,162 @@ void ProcessManager::AddProcesses(size_t num_processes)
 		AddProcess(i + 1);
 }
 
+size_t ProcessManager::GetMinerCount() const
+{
+	std::shared_lock<std::shared_mutex> g(minersMtx);
+	return CountActiveMiners();
+}
+
+void ProcessManager::Resize(size_t n)
+{
+	if (n == 0)
+		throw std::exception("A manager needs at least one miner");
+	ChangeFleet([this, n]()
+		{
+			size_t active = CountActiveMiners();
+			if (n > active)
+				AddMinersNow(n - active);
+			for (size_t i = miners.size(); i-- > 0 && active > n;)
+			{
+				if (!miners[i]->Retired())
+				{
+					RetireMinerNow(miners[i]->GetPID());
+					active--;
+				}
+			}
+		}
+	);
+}
+
+void ProcessManager::AddMiners(size_t count)
+{
+	ChangeFleet([this, count]() { AddMinersNow(count); });
+}
+
+void ProcessManager::RetireMiner(size_t PID)
+{
+	ChangeFleet([this, PID]() { RetireMinerNow(PID); });
+}
+
+void ProcessManager::StartAutoscaler(size_t min_miners, size_t max_miners, std::chrono::milliseconds interval)
+{
+	assert(min_miners != 0 && min_miners <= max_miners);
+	StopAutoscaler();
+	autoscaleStopping = false;
+	autoscaler = std::thread([this, min_miners, max_miners, interval]() { AutoscalerFunc(min_miners, max_miners, interval); });
+}
+
+void ProcessManager::StopAutoscaler()
+{
+	{
+		std::lock_guard<std::mutex> g(autoscaleMtx);
+		autoscaleStopping = true;
+	}
+	autoscaleCv.notify_all();
+	if (autoscaler.joinable())
+		autoscaler.join();
+}
+
+void ProcessManager::ChangeFleet(std::function<void()> change)
+{
+	std::packaged_task<void()> task(std::move(change));
+	auto done = task.get_future();
+	{
+		std::lock_guard<std::mutex> g(jobMtx);
+		// the coordinator would never get to it
+		if (stopping)
+			throw std::exception("Manager is shutting down");
+		fleetChanges.push_back(std::move(task));
+	}
+	jobCv.notify_all();
+	done.get();
+}
+
+void ProcessManager::ApplyFleetChanges()
+{
+	std::deque<std::packaged_task<void()>> changes;
+	{
+		std::lock_guard<std::mutex> g(jobMtx);
+		changes.swap(fleetChanges);
+	}
+	for (auto& c : changes)
+		c();
+}
+
+void ProcessManager::AddMinersNow(size_t count)
+{
+	// retired miners come back first, so the fleet never holds more miners than it has ever needed at once
+	for (auto& m : miners)
+	{
+		if (count == 0)
+			return;
+		if (m->Retired())
+		{
+			m->Restart();
+			count--;
+		}
+	}
+	for (; count > 0; count--)
+		AddProcess(miners.size() + 1);
+}
+
+void ProcessManager::RetireMinerNow(size_t PID)
+{
+	for (auto& m : miners)
+	{
+		if (m->GetPID() == PID && !m->Retired())
+		{
+			if (CountActiveMiners() == 1)
+				throw std::exception("Cannot retire the last miner");
+			m->Retire();
+			return;
+		}
+	}
+	throw std::exception("No mining miner with that PID");
+}
+
+size_t ProcessManager::CountActiveMiners() const
+{
+	size_t active = 0;
+	for (auto& m : miners)
+		active += !m->Retired();
+	return active;
+}
+
+void ProcessManager::AutoscalerFunc(size_t min_miners, size_t max_miners, std::chrono::milliseconds interval)
+{
+	CpuMonitor cpu;
+	const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	std::unique_lock<std::mutex> lk(autoscaleMtx);
+	while (!autoscaleCv.wait_for(lk, interval, [this]() { return autoscaleStopping; }))
+	{
+		lk.unlock();
+		size_t depth;
+		{
+			std::lock_guard<std::mutex> g(jobMtx);
+			depth = inFlight;
+		}
+		// the cores other processes on the box left free, the miners' own use counts as free
+		const double free_cores = cores * (1.0 - cpu.SampleOthersBusy());
+		const size_t target = depth == 0 ? min_miners : std::clamp(size_t(free_cores + 0.5), min_miners, max_miners);
+		const size_t current = GetMinerCount();
+		// one miner a tick, so a short burst or a noisy sample does not swing the whole fleet
+		try
+		{
+			if (target > current)
+				Resize(current + 1);
+			else if (target < current)
+				Resize(current - 1);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "autoscaler: " << e.what() << std::endl;
+		}
+		lk.lock();
+	}
+}
+
 void ProcessManager::PostQuitMessage()
 {
-	msgLine.push(std::make_shared<QuitMessage>());
+	BroadcastMessage(msgPool.Make<QuitMessage>());
 }
@@ -1,23 +1,49 @@
 #pragma once
 #include <queue>
 #include <thread>
-#include <Windows.h>
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include <unordered_map>
+#include <array>
 #include <functional>
 #include <optional>
+#include <future>
+#include <deque>
 #include <typeindex>
+#include <chrono>
 #include <fstream>
 #include "nlohmann.h"
 #include <string>
 #include <iostream>
 #include "Block.h"
+#include "BroadcastRing.h"
+#include "BlockLog.h"
+#include "OwnerIndex.h"
+#include "ReaderPool.h"
+#include "LatencyHistogram.h"
+#include "MessagePool.h"
 
 class ProcessManager
 {
 public:
+	// compile time ids of the message types the system is built around, their handlers are
+	// found by indexing an array instead of hashing a type_index
+	// any other message type is Dynamic and is looked up by its type_index
+	enum class MessageKind : uint8_t
+	{
+		Dynamic,
+		Quit,
+		Response,
+		Verify,
+		HashPuzzle1,
+		HashPuzzle2,
+		Count
+	};
+
 	// messages used to communicate with the processes
 	// this is the base class, main wil inherit from this
 	// to create different kinds of messages
@@ -25,7 +51,7 @@ public:
 	{
 	public:
 		// parameterized ctor, no defaults
-		Message(std::type_index typeID, size_t senderID);
+		Message(std::type_index typeID, size_t senderID, MessageKind kind = MessageKind::Dynamic);
 		// virtual dtor as many classes will be inheriting from this class
 		virtual ~Message() = default;// { std::cout << ID << ": Im die\n"; };
 		// id used to uniquely identify messages
@@ -33,55 +59,142 @@ public:
 		// any ID to differentiate the messages
 		// this MUST match with a function id in the message handler
 		std::type_index GetMessageTypeID() const;
+		MessageKind GetKind() const;
 		// id of the process broadcasting the message (could also be main or the manager itself)
 		size_t GetSenderID() const;
+		// checks a block another miner returned for this message, the verifiers call it on the puzzle
+		// messages with nothing to check accept any block
+		virtual bool VerifyBlock(const Block& b) const;
+		// phase timing, PhaseNow() times of the broadcast and of the first miner starting on the message
+		void StampBroadcast(int64_t ns);
+		// only the first miner's stamp is kept
+		void StampPickUp(int64_t ns);
+		int64_t GetBroadcastTime() const;
+		int64_t GetPickUpTime() const;
+		// tells the handlers still working on this message to stop, see MinerContext::StopRequested
+		void Cancel();
+		bool Cancelled() const;
 	private:
-		static size_t count;
+		// responses are created on the miner threads, so this has to be atomic
+		static std::atomic<size_t> count;
+		std::atomic<int64_t> broadcastNs = 0;
+		std::atomic<int64_t> pickUpNs = 0;
+		std::atomic<bool> cancelled = false;
 		const size_t ID;
 		std::type_index messageTypeID;
 		const size_t senderID;
+		const MessageKind kind;
 	};
 
 	// processes use this to send the results of their processing
 	class Response : public Message
 	{
 	public:
-		Response(size_t sender_id, const Block& res)
+		static constexpr MessageKind kind = MessageKind::Response;
+	public:
+		Response(size_t sender_id, size_t request_id, Block res)
 			:
-			Message(typeid(Response), sender_id),
-			res(res)
+			Message(typeid(Response), sender_id, kind),
+			requestID(request_id),
+			res(std::move(res))
 		{}
-		Block GetBlock() const
+		const Block& GetBlock() const
 		{
 			return res;
 		}
+		// id of the message this is a response to
+		size_t GetRequestID() const
+		{
+			return requestID;
+		}
 	private:
+		const size_t requestID;
 		Block res;
 	};
 
+	// passed to message handlers along with the message
+	// long running handlers should poll StopRequested() and give up once it returns true
+	class MinerContext
+	{
+	public:
+		MinerContext(size_t PID, const Message& msg, std::atomic<uint64_t>& hashes, const std::atomic<bool>& retiring)
+			:
+			PID(PID),
+			msg(msg),
+			hashes(hashes),
+			retiring(retiring)
+		{}
+		// id of the process running the handler
+		size_t GetPID() const
+		{
+			return PID;
+		}
+		// true once the manager no longer needs a result for the message being handled
+		// or the miner is being retired
+		bool StopRequested() const
+		{
+			return msg.Cancelled() || retiring.load(std::memory_order_relaxed);
+		}
+		// adds to the number of hashes the miner has tried, shows up in GetStats
+		void ReportHashes(uint64_t n) const
+		{
+			hashes.fetch_add(n, std::memory_order_relaxed);
+		}
+	private:
+		const size_t PID;
+		// the message being handled
+		const Message& msg;
+		// the miner's hash counter
+		std::atomic<uint64_t>& hashes;
+		const std::atomic<bool>& retiring;
+	};
+
+	// what a miner has done since it started, see GetStats
+	struct MinerStats
+	{
+		size_t PID = 0;
+		// "running", "waiting", "terminated" or "retired"
+		const char* state = "";
+		uint64_t hashes = 0;
+		// puzzles the miner's handler returned a block for
+		uint64_t solutions = 0;
+		// other miners' blocks this miner checked and agreed with
+		uint64_t verifications = 0;
+		uint64_t messages = 0;
+		// handlers that threw, the miner carries on with the next message
+		uint64_t exceptions = 0;
+		double runningSeconds = 0.0;
+		double waitingSeconds = 0.0;
+
+		// hashes per second of running time
+		double HashRate() const
+		{
+			return runningSeconds > 0.0 ? hashes / runningSeconds : 0.0;
+		}
+	};
+
 	// when possible, these typedefs should be used for one's own sanity
 	typedef std::shared_ptr<Message> MsgPtr;
-	typedef std::function<std::optional<Block>(const MsgPtr)> Callable;
+	typedef std::function<std::optional<Block>(const MsgPtr, const MinerContext&)> Callable;
 
 private:
+	// the queue messages are broadcast on, each miner reads it through its own cursor
+	typedef BroadcastRing<MsgPtr> MessageLine;
+
 	// used to define how a process will handle messages it receives
-	// also counts to how many times it is called, the process manager
-	// automatically removes messages from the queue once all processes have seen them
 	class MessageHandlerMap
 	{
 	public:
-		MessageHandlerMap(std::queue<MsgPtr>& msgLine, std::type_index quit_id);
-		// called by a process to handle messages
-		std::optional<Callable> GetMessageHandler(const MsgPtr msg) const;
-		// MUST update this after adding a new process
-		void SetNumProcesses(size_t num_processes);
+		// called by a process to handle messages, nullptr for a quit message
+		// the handler is not copied, so finding it never allocates
+		const Callable* GetMessageHandler(const Message& msg) const;
 		void AddFunc(std::type_index id, Callable);
+		void AddFunc(MessageKind kind, Callable);
 	private:
-		size_t num_processes = 0;
+		// handlers of the compile time kinds, indexed by MessageKind
+		std::array<Callable, size_t(MessageKind::Count)> kindFuncs;
+		// handlers of every other message type
 		std::unordered_map<std::type_index, Callable> funcMap;
-		std::queue<MsgPtr>& msgLine;
-		mutable size_t count = 0;
-		const std::type_index quit_id;
 	};
 
 	// holds the miners and data for them to use
@@ -95,8 +208,9 @@ private:
 		};
 	public:
 		// no default constructors
-		Miner(size_t PID, const std::queue<MsgPtr>& incoming_messages, std::mutex& mtx, std::mutex& wMtx,
-			std::function<std::optional<std::string>(const MsgPtr)> sendMessage, const MessageHandlerMap& msgHandler);
+		Miner(size_t PID, MessageLine& incoming_messages, std::mutex& mtx, std::mutex& wMtx,
+			std::condition_variable& msgCv, std::condition_variable& doneCv,
+			std::function<std::optional<std::string>(const MsgPtr)> sendMessage, const MessageHandlerMap& msgHandler, MessagePool& msgPool);
 		// joins the processes and waits for it to exit
 		~Miner();
 		size_t GetPID() const;
@@ -114,24 +228,39 @@ private:
 		{
 			return s == State::Running;
 		}
-		// save a pased json object
-		void SaveBlock(const nlohmann::json& j);
+		// true from the moment the miner is told to retire, even if its thread has not stopped yet
+		bool Retired() const
+		{
+			return retiring;
+		}
+		// tells the miner to stop reading messages, it gives up on the message it is handling,
+		// leaves the message line and stops its thread, its log stays open for queries and SaveBlock
+		void Retire();
+		// brings a retired miner back, it sees every message broadcast from now on
+		void Restart();
+		// append a mined block to the miner's log
+		void SaveBlock(const BlockRecord& r);
+		void SetDurability(BlockLog::Durability d);
+		BlockLog::Stats GetStorageStats() const;
+		// reads the counters, the time spent in the current state so far is included
+		MinerStats GetStats() const;
+		// waits until every block saved so far has been written to the log, and writes out the index
+		void FlushLog();
 		// get data from the process in json form based on a given predicate
+		// the predicate sees a BlockView into the mapped log, json is only built for matches
 		template <typename Pred>
-		nlohmann::json GetBlocks(Pred p)
+		nlohmann::json GetBlocks(Pred p) const
 		{
 			nlohmann::json arr = nlohmann::json::array();
-			std::ifstream in(filename);
 
 			try
 			{
-				while (in.peek() != EOF)
-				{
-					nlohmann::json obj;
-					in >> obj;
-					if (!obj.is_null() && p(obj))
-						arr.push_back(obj);
-				}
+				log.ForEachView([&arr, &p](const BlockView& v)
+					{
+						if (p(v))
+							arr.push_back(v.GetJSON());
+					}
+				);
 			}
 			catch (const std::exception& e)
 			{
@@ -140,31 +269,126 @@ private:
 
 			return arr;
 		}
+		// the blocks with the given ownerID, looked up through the index instead of scanning the log
+		nlohmann::json GetBlocksByOwner(std::string_view owner_id) const;
+		// calls callback with each block from offset start on that satisfies pred, until remaining reaches 0
+		// returns the offset to carry on from if it stopped early, nothing if the whole log was read
+		template <typename Pred, typename F>
+		std::optional<uint64_t> ForEachBlock(Pred& pred, F& callback, uint64_t start, size_t& remaining) const
+		{
+			bool stopped = false;
+			uint64_t end = log.ForEachViewFrom(start, [&](const BlockView& v, uint64_t, uint32_t)
+				{
+					if (!pred(v))
+						return true;
+					callback(v);
+					stopped = --remaining == 0;
+					return !stopped;
+				}
+			);
+			if (stopped)
+				return end;
+			return {};
+		}
 
 	private:
 		// gets called once when a new thread starts execution
 		void func();
+		// adds the time since the last change of state to that state's total and moves to s
+		void SetState(State next);
+	private:
+		// name of the log a miner with the given PID stores its blocks in
+		static std::string LogFilename(size_t PID);
+		// name of the file the ownerID index of that log is kept in
+		static std::string IndexFilename(size_t PID);
 	private:
-		std::string filename;
+		// the blocks this miner has saved
+		BlockLog log;
+		// where each owner's blocks are in log
+		OwnerIndex index;
 
-		State s = State::Waiting;
+		// written only by the miner's thread and read by GetStats, on their own cache line
+		// so the manager polling them does not slow the miner down
+		struct alignas(64) Counters
+		{
+			std::atomic<uint64_t> hashes = 0;
+			std::atomic<uint64_t> solutions = 0;
+			std::atomic<uint64_t> verifications = 0;
+			std::atomic<uint64_t> messages = 0;
+			std::atomic<uint64_t> exceptions = 0;
+			std::atomic<int64_t> runningNs = 0;
+			std::atomic<int64_t> waitingNs = 0;
+			// steady clock time of the last change of state
+			std::atomic<int64_t> stateSince = 0;
+		};
+		Counters counters;
+		std::atomic<State> s = State::Waiting;
+		std::atomic<bool> retiring = false;
 		// thread id
 		const size_t PID;
 		// everything used by the thread
-		// used when calling the message handler
+		// only taken to park the miner while it has nothing to read
 		std::mutex& mtx;
+		// signalled when a new message is broadcast, the miner parks on it while idle
+		std::condition_variable& msgCv;
+		// signalled whenever the miner finishes a message, used by the manager to wait for completion
+		std::condition_variable& doneCv;
 		// used for getting the appropriate function to handle a message
 		const MessageHandlerMap& msgHandler;
+		// responses are made from this
+		MessagePool& msgPool;
 		// used when calling send messages
 		std::mutex& wMtx;
 		// used to send messages outside of the thread
 		std::function<std::optional<std::string>(const MsgPtr)> sendMessage;
 		// contains messages from the outside (also potentially from othr processes)
-		const std::queue<MsgPtr>& incoming_messages;
+		MessageLine& incoming_messages;
+		// this miner's read position in incoming_messages, released by the thread when the miner retires
+		size_t cursor;
 		// the actual process/miner
 		std::thread t;
 	};
 
+public:
+	// where a paged ForEachBlock stopped, passed back in to carry on from the next block
+	// can be turned into a string token and back, e.g. to hand to a client between requests
+	class BlockCursor
+	{
+		friend class ProcessManager;
+	public:
+		// a cursor at the first block
+		BlockCursor() = default;
+		// true once every block has been visited
+		bool Done() const;
+		// "<PID>:<offset>", or "end" once done
+		std::string GetToken() const;
+		// throws if the token was not made by GetToken
+		static BlockCursor FromToken(const std::string& token);
+	private:
+		BlockCursor(size_t PID, uint64_t offset, bool done);
+	private:
+		// miner to carry on with and the offset in its log, 0 for its first block
+		size_t PID = 0;
+		uint64_t offset = 0;
+		bool done = false;
+	};
+
+	// the phases of mining a block that are timed when DS_PHASE_TIMING is on
+	enum class Phase
+	{
+		// broadcast until the first miner starts on the message
+		Dispatch,
+		// broadcast until the first solution reaches the manager
+		FirstSolution,
+		// cancelling the other miners and waiting for a quorum of them to agree with the winner
+		Verify,
+		// building the record to store
+		Serialise,
+		// handing the record to the miner's log, including waiting for the disk if the durability asks for it
+		Persist,
+		Count
+	};
+
 public:
 	/*Basic*/
 	// ctor
@@ -173,26 +397,131 @@ public:
 	~ProcessManager();
 	// add a handler function to the message handler
 	void AddMessageHandler(std::type_index msg_id, Callable func);
+	// add a handler for a message type with a compile time kind (T::kind), dispatched without hashing
+	template <typename T>
+	void AddMessageHandler(Callable func)
+	{
+		static_assert(T::kind != MessageKind::Dynamic && T::kind != MessageKind::Quit, "T needs a compile time message kind");
+		msgHandler.AddFunc(T::kind, std::move(func));
+	}
+	// makes a message in memory recycled from earlier messages, so it does not allocate once the manager has warmed up
+	// the manager makes its own responses and quit messages this way
+	template <typename T, typename... Args>
+	std::shared_ptr<T> MakeMessage(Args&&... args)
+	{
+		return msgPool.Make<T>(std::forward<Args>(args)...);
+	}
+	MessagePool::Stats GetMessagePoolStats() const;
 	
 	/*Block Related*/
-	// passes given json block to the specified process to store
-	void SaveBlock(size_t PID, nlohmann::json j);
+	// passes given block to the specified process to store
+	void SaveBlock(size_t PID, const BlockRecord& r);
 	// returs a json array of all blocks that satisfy the given predicate
+	// the predicate is called with a const BlockView&, from several reader threads at once
 	template <typename Pred>
-	nlohmann::json GetBlocks(Pred pred)
+	nlohmann::json GetBlocks(Pred pred) const
 	{
-		nlohmann::json arr = nlohmann::json::array();
-		for (auto& p : miners)
+		return QueryMiners([&pred](const Miner& m) { return m.GetBlocks(pred); });
+	}
+	// calls callback(const BlockView&) with each block that satisfies pred, one miner after another,
+	// so only one block is held at a time however many match
+	// stops after limit blocks and returns a cursor to pass back in for the next page
+	// throws if limit is 0, that page could never move the cursor on
+	// exceptions thrown while reading a log or by the callbacks are passed on
+	// the callback must not change the fleet, that waits for this to finish
+	template <typename Pred, typename F>
+	BlockCursor ForEachBlock(Pred pred, F callback, BlockCursor from = BlockCursor(), size_t limit = SIZE_MAX) const
+	{
+		if (limit == 0)
+			throw std::exception("Block page limit must not be 0");
+		if (from.done)
+			return from;
+		std::shared_lock<std::shared_mutex> g(minersMtx);
+		size_t remaining = limit;
+		for (auto& m : miners)
 		{
-			nlohmann::json data = p->GetBlocks(pred);
-			arr.insert(arr.end(), data.begin(), data.end());
+			if (m->GetPID() < from.PID)
+				continue;
+			const uint64_t start = m->GetPID() == from.PID ? from.offset : 0;
+			if (remaining == 0)
+				return BlockCursor(m->GetPID(), start, false);
+			if (auto next = m->ForEachBlock(pred, callback, start, remaining))
+				return BlockCursor(m->GetPID(), *next, false);
 		}
-		return arr;
+		return BlockCursor(0, 0, true);
 	}
-	// broadcasts passed message to all processes, waits for processes to complete processing then 
-	// removes all responses from the queue and passes the block to the process that comleted first
-	// returns the hash of the mined block
+	// returns a json array of all blocks with the given ownerID
+	// same result as GetBlocks with a predicate on ownerID, but only the matching records are read
+	nlohmann::json GetBlocksByOwner(std::string_view owner_id) const;
+	// broadcasts passed message to all processes and waits for the first response
+	// the remaining miners are then told to stop and each of them re-hashes the winner's nonce,
+	// once the verification quorum agrees the block is passed to the process that completed first
+	// returns the hash of the mined block, throws if too many verifiers reject it to reach the quorum
 	size_t MineBlock(MsgPtr msg);
+	// queues the message to be mined in the background and returns straight away
+	// the future holds the hash of the mined block (or the exception MineBlock would have thrown)
+	// blocks are mined in submission order, the next one starts while the previous one is being saved
+	// blocks while the in-flight window is full
+	std::future<size_t> MineBlockAsync(MsgPtr msg);
+	// limits how many blocks can be queued or mining at once, defaults to defaultMaxInFlight
+	void SetMaxInFlight(size_t max_in_flight);
+	// waits until every block submitted so far has been mined and saved
+	void WaitForPendingBlocks();
+	// how many of the other miners have to agree with a winning block before it is saved,
+	// capped at the number of other miners, 0 saves blocks without verifying them
+	// defaults to defaultVerificationQuorum
+	void SetVerificationQuorum(size_t quorum);
+
+	/*Stats Related*/
+	// latencies of one phase of every block mined so far, empty when DS_PHASE_TIMING is 0
+	const LatencyHistogram& GetPhaseHistogram(Phase p) const;
+	static const char* GetPhaseName(Phase p);
+	// one line per phase with its count, mean, p50, p90, p99, p99.9 and max in microseconds
+	void WritePhaseLatencies(std::ostream& out) const;
+	// a snapshot of every miner's counters, in PID order
+	std::vector<MinerStats> GetStats() const;
+	// appends GetStats() to filename every interval on a background thread until StopStatsDump
+	// one line per miner per dump, "<unix ms> pid=<PID> state=<state> hashes=<n> ..." with the
+	// keys always in the same order so other tools can parse it
+	void StartStatsDump(const std::string& filename, std::chrono::milliseconds interval);
+	void StopStatsDump();
+	// writes one dump of GetStats() to out in the format above
+	void WriteStats(std::ostream& out) const;
+	// records every message's broadcast, pick up by each miner, handler run and response from now on,
+	// and writes it to filename as a chrome trace (chrome://tracing or Perfetto) when the manager is destroyed
+	void EnableTracing(const std::string& filename);
+
+	/*Fleet Related*/
+	// the fleet can change while blocks are being mined, the changes are made by the coordinator
+	// between two blocks and the calls below wait until theirs has been made
+	// number of miners taking part in mining, retired ones are not counted
+	size_t GetMinerCount() const;
+	// adds or retires miners until n are mining, retiring the highest PIDs first, n must not be 0
+	void Resize(size_t n);
+	// starts count more miners, retired ones come back first with their old PIDs and logs
+	void AddMiners(size_t count);
+	// stops the miner from taking part in mining, the blocks it stored can still be queried
+	// throws if PID is not a mining miner or is the last one
+	void RetireMiner(size_t PID);
+	// every interval, grows an idle fleet towards min_miners and a busy one towards the cores
+	// other processes are leaving free, within [min_miners, max_miners], one miner at a time
+	// runs on a background thread until StopAutoscaler
+	void StartAutoscaler(size_t min_miners, size_t max_miners, std::chrono::milliseconds interval);
+	void StopAutoscaler();
+
+	/*Storage Related*/
+	// when the miners' logs force saved blocks out to the disk, and so when MineBlock returns
+	// BlockLog::Durability::None by default, set it before mining
+	void SetDurability(BlockLog::Durability d);
+	// the write stats of every miner's log added together
+	BlockLog::Stats GetStorageStats() const;
+	// waits until every block saved so far has been written to the miners' logs
+	void FlushStorage() const;
+
+	/*Query Related*/
+	// limits how many miners' stores are read at once by a query, defaults to half the hardware threads
+	// waits for the queries already running to finish
+	void SetMaxReaders(size_t max_readers);
 
 private:
 	// this will push a quit message to the queue
@@ -202,18 +531,85 @@ private:
 	void AddProcess(size_t id);
 	// add multiple processes
 	void AddProcesses(size_t num_processes);
+	// queues a change to the fleet for the coordinator and waits for it to be made, rethrows what it threw
+	void ChangeFleet(std::function<void()> change);
+	// runs on the coordinator, makes the changes queued so far
+	void ApplyFleetChanges();
+	// the fleet changes themselves, only ever run on the coordinator
+	void AddMinersNow(size_t count);
+	void RetireMinerNow(size_t PID);
+	// miners that are not retired, the coordinator can call it without holding minersMtx
+	size_t CountActiveMiners() const;
+	void AutoscalerFunc(size_t min_miners, size_t max_miners, std::chrono::milliseconds interval);
+
+	/*Mining Pipeline Related*/
+	// a block waiting to be mined by the coordinator
+	struct MiningJob
+	{
+		MsgPtr msg;
+		std::promise<size_t> result;
+	};
+	// a mined block waiting to be saved
+	struct MinedBlock
+	{
+		size_t PID;
+		BlockRecord record;
+	};
+	// runs on the coordinator thread, mines queued jobs one after another
+	void CoordinatorFunc();
+	// waits for a job to be queued, returns nothing once the manager is shutting down
+	std::optional<MiningJob> WaitForJob();
+	// the phases of mining a block, MineBlock runs them in order
+	// FinishMining waits for the winner of an already broadcast message and builds the block to save
+	MinedBlock FinishMining(MsgPtr msg);
+	// adds end - start to the phase's histogram
+	void RecordPhase(Phase p, int64_t start, int64_t end);
+	// saves the block with its miner and returns its hash
+	size_t PersistBlock(const MinedBlock& mined);
+
+	/*Query Related*/
+	// runs query on every miner on the reader pool and concatenates the json arrays it returns
+	// in miner order, so the result is the same as running them one after another
+	template <typename Query>
+	nlohmann::json QueryMiners(Query query) const
+	{
+		std::shared_lock<std::shared_mutex> g(minersMtx);
+		std::vector<nlohmann::json> parts(miners.size());
+		std::vector<std::future<void>> done;
+		done.reserve(miners.size());
+		for (size_t i = 0; i < miners.size(); i++)
+		{
+			const Miner& m = *miners[i];
+			done.push_back(readers.Submit([&parts, &query, &m, i]() { parts[i] = query(m); }));
+		}
+		// every task has to finish before parts goes away, even if one of them threw
+		for (auto& f : done)
+			f.wait();
+		for (auto& f : done)
+			f.get();
+
+		nlohmann::json arr = nlohmann::json::array();
+		for (auto& data : parts)
+			arr.insert(arr.end(), data.begin(), data.end());
+		return arr;
+	}
 
 	/*Processing Management Related*/
 	// adds a mesage to the queue to make it visible to all processes
 	void BroadcastMessage(MsgPtr msg);
 	// check if processes are running or if messages are left to be processed
+	// must be called with mtx held
 	bool Completed() const;
 	// waits until Completed() returns true
 	void WaitForCompletion() const;
 	// check if the response queue has any responses in it
 	bool ResponsesAreAvailable() const;
-	// removes the first recieved response from the response queue and returns it
-	MsgPtr GetFirstResponse();
+	// waits for the first response to the given message, responses to older messages are discarded
+	// throws if every miner finishes without responding
+	MsgPtr WaitForFirstResponse(size_t msg_id);
+	// asks every miner but the winner to check the winner's block and waits for quorum of them to agree
+	// returns how many agreed, throws once enough have rejected it that the quorum cannot be reached
+	size_t VerifyBlock(MsgPtr puzzle, const Response& winner, size_t quorum);
 
 private:
 	class QuitMessage : public Message
@@ -221,15 +617,103 @@ private:
 	public:
 		QuitMessage()
 			:
-			Message(typeid(QuitMessage), 0)
+			Message(typeid(QuitMessage), 0, MessageKind::Quit)
 		{}
 	};
 
+	// a winning block for the other miners to check, sent as the winner so the winner skips it
+	class VerifyMessage : public Message
+	{
+	public:
+		VerifyMessage(size_t winner_id, MsgPtr puzzle, const Block& block)
+			:
+			Message(typeid(VerifyMessage), winner_id, MessageKind::Verify),
+			puzzle(std::move(puzzle)),
+			block(block)
+		{}
+		const MsgPtr& GetPuzzle() const
+		{
+			return puzzle;
+		}
+		const Block& GetBlock() const
+		{
+			return block;
+		}
+		// verifiers that agree respond with the block, the ones that do not only count themselves here
+		void Reject()
+		{
+			rejected.fetch_add(1, std::memory_order_relaxed);
+		}
+		size_t GetRejectedCount() const
+		{
+			return rejected.load(std::memory_order_relaxed);
+		}
+	private:
+		MsgPtr puzzle;
+		Block block;
+		std::atomic<size_t> rejected = 0;
+	};
+
 private:
-	std::mutex mtx;
-	std::mutex wMtx;
-	std::vector<std::unique_ptr<Miner>> miners;
-	std::queue<MsgPtr> msgLine;
+	// slots in the message line, a broadcast blocks once the slowest miner is this far behind
+	static constexpr size_t msgLineCapacity = 1024;
+	// blocks that can be queued or mining at once before MineBlockAsync blocks
+	static constexpr size_t defaultMaxInFlight = 4;
+	// other miners that have to agree with a winning block
+	static constexpr size_t defaultVerificationQuorum = 2;
+	// upper bound on the number of miners reading the message line
+	static constexpr size_t maxMiners = 256;
+
+	mutable std::mutex mtx;
+	// guards processResults
+	mutable std::mutex wMtx;
+	// signalled when a response is pushed to processResults
+	std::condition_variable resultCv;
+	// wakes idle miners when a message is broadcast
+	std::condition_variable msgCv;
+	// wakes the manager when a miner finishes processing a message
+	mutable std::condition_variable doneCv;
+	MessageLine msgLine;
 	std::queue<MsgPtr> processResults;
 	MessageHandlerMap msgHandler;
+	MessagePool msgPool;
+	// guards everything used by the coordinator
+	std::mutex jobMtx;
+	// signalled when a job is queued, finished or the manager shuts down
+	std::condition_variable jobCv;
+	std::deque<MiningJob> jobs;
+	// queued by ChangeFleet, made by the coordinator between blocks
+	std::deque<std::packaged_task<void()>> fleetChanges;
+	// jobs queued plus the one being mined
+	size_t inFlight = 0;
+	size_t maxInFlight = defaultMaxInFlight;
+	std::atomic<size_t> verificationQuorum = defaultVerificationQuorum;
+	bool stopping = false;
+	// only the coordinator changes miners once the manager is built, it holds this exclusively while it does
+	// every other thread reads miners under a shared lock
+	mutable std::shared_mutex minersMtx;
+	// declared after everything a miner thread uses (the message line, the locks and condition variables above,
+	// processResults, the handlers and the message pool) so those outlive the threads, which are joined here
+	// the members below are either threads the destructor joins first or, like readers, must go before the miners
+	// retired miners are kept so their logs can still be queried
+	std::vector<std::unique_ptr<Miner>> miners;
+	// runs the per-miner parts of queries, destroyed before the miners it reads from
+	mutable ReaderPool readers;
+	LatencyHistogram phaseHistograms[size_t(Phase::Count)];
+	// guards statsStopping
+	std::mutex statsMtx;
+	// wakes the stats dumper early when it is told to stop
+	std::condition_variable statsCv;
+	bool statsStopping = false;
+	std::thread statsDumper;
+	// guards autoscaleStopping
+	std::mutex autoscaleMtx;
+	// wakes the autoscaler early when it is told to stop
+	std::condition_variable autoscaleCv;
+	bool autoscaleStopping = false;
+	std::thread autoscaler;
+	// where the trace is written on destruction, empty when tracing is off
+	std::string traceFile;
+	// mines the blocks submitted through MineBlockAsync
+	std::thread coordinator;
 };
@@ -1,45 +1,151 @@
 #pragma once
 #include "ProcessManager.h"
 #include "Block.h"
+#include "Sha256.h"
+#include "FastMod.h"
+#include "Random.h"
+
+// the hasher every node uses for a block, the part of the input that
+// does not depend on the nonce is hashed once when the hasher is made
+// Hasher can be Sha256Midstate or Fnv1aMidstate (HashEngine.h)
+template <typename Hasher = Sha256Midstate>
+Hasher MakeBlockHasher(const Block& block)
+{
+	return Hasher({ block.GetMsg(), block.GetOwnerName(), block.GetMsg() });
+}
+
+// splits the nonces of a puzzle into disjoint ranges that are leased out to the miners
+// so no two miners ever hash the same nonce
+class NonceSpace
+{
+public:
+	// half open range of nonces [begin, end)
+	struct Range
+	{
+		size_t begin;
+		size_t end;
+	};
+public:
+	// hands out the next count nonces, safe to call from any thread
+	// ranges come straight off one counter, so no two of them can overlap
+	Range Lease(size_t count)
+	{
+		size_t begin = next.fetch_add(count, std::memory_order_relaxed);
+		return { begin, begin + count };
+	}
+	// total number of nonces leased so far
+	size_t GetLeasedCount() const
+	{
+		return next.load(std::memory_order_relaxed);
+	}
+	// called by a miner with how many nonces of its leases it actually hashed
+	void ReportHashed(size_t count)
+	{
+		hashed.fetch_add(count, std::memory_order_relaxed);
+	}
+	size_t GetHashedCount() const
+	{
+		return hashed.load(std::memory_order_relaxed);
+	}
+	// nonces hashed beyond the distinct ones ever leased, so at least this many were hashed more than once
+	// this should always be 0, it exists to prove that
+	size_t GetDuplicateCount() const
+	{
+		const size_t h = GetHashedCount();
+		const size_t leased = GetLeasedCount();
+		return h > leased ? h - leased : 0;
+	}
+private:
+	std::atomic<size_t> next = 0;
+	// bumped once per lease, like next
+	std::atomic<size_t> hashed = 0;
+};
 
 class HashPuzzle1 : public ProcessManager::Message
 {
+public:
+	static constexpr ProcessManager::MessageKind kind = ProcessManager::MessageKind::HashPuzzle1;
 public:
 	HashPuzzle1(const Block& block)
 		:
-		ProcessManager::Message(std::type_index(typeid(HashPuzzle1)), 0),
+		ProcessManager::Message(std::type_index(typeid(HashPuzzle1)), 0, kind),
 		block(block)
 	{
-		modResReq = rand() % 100;
-		modVal = 1 + modResReq + rand() % 2000;
+		auto& rng = Random::ThreadRng();
+		modResReq = rng.Below(100);
+		modVal = 1 + modResReq + rng.Below(2000);
+		mod = FastMod(modVal);
+	}
+	// a puzzle with a chosen difficulty, about mod_val hashes are needed on average
+	HashPuzzle1(const Block& block, unsigned int mod_val, unsigned int mod_res_req)
+		:
+		ProcessManager::Message(std::type_index(typeid(HashPuzzle1)), 0, kind),
+		block(block),
+		modVal(mod_val),
+		modResReq(mod_res_req % mod_val),
+		mod(mod_val)
+	{
 	}
 	// returns the block passed to it
-	Block GetBlock() const
+	const Block& GetBlock() const
 	{
 		return block;
 	}
 	// used to verify if a hash satisfies the given conditions
 	bool Verify(size_t hash) const
 	{
-		return (hash % modVal) == modResReq;
+		return mod.Mod(hash) == modResReq;
+	}
+	// index of the first of n hashes that satisfies the puzzle, n if none do
+	// no branches in the loop, so it costs the same whether or not there is a match
+	size_t VerifyMany(const size_t* hashes, size_t n) const
+	{
+		size_t found = n;
+		for (size_t i = n; i-- > 0;)
+			found = mod.Mod(hashes[i]) == modResReq ? i : found;
+		return found;
+	}
+	// checks a mined block, its hash has to match its nonce and satisfy the puzzle
+	bool VerifyBlock(const Block& b) const override
+	{
+		return Verify(b.GetHash()) && MakeBlockHasher(b).Hash(b.GetNonce()) == b.GetHash();
+	}
+	// gives the calling miner a range of nonces no other miner will try
+	NonceSpace::Range LeaseNonces(size_t count)
+	{
+		return nonces.Lease(count);
+	}
+	// how many nonces of its leases a miner hashed, for the duplicate count
+	void ReportNoncesHashed(size_t count)
+	{
+		nonces.ReportHashed(count);
+	}
+	const NonceSpace& GetNonceSpace() const
+	{
+		return nonces;
 	}
 private:
 	Block block;
+	NonceSpace nonces;
 	unsigned int modVal;
 	unsigned int modResReq;
+	// reciprocal of modVal so Verify does not divide
+	FastMod mod;
 };
 
 class HashPuzzle2 : public ProcessManager::Message
 {
+public:
+	static constexpr ProcessManager::MessageKind kind = ProcessManager::MessageKind::HashPuzzle2;
 public:
 	HashPuzzle2(const Block& block)
 		:
-		ProcessManager::Message(std::type_index(typeid(HashPuzzle2)), 0),
+		ProcessManager::Message(std::type_index(typeid(HashPuzzle2)), 0, kind),
 		block(block)
 	{
 	}
 	// returns the block passed to it
-	Block GetBlock() const
+	const Block& GetBlock() const
 	{
 		return block;
 	}
@@ -48,12 +154,88 @@ public:
 	{
 		return (hash % 10) == 0;
 	}
+	// index of the first of n hashes that satisfies the puzzle, n if none do
+	size_t VerifyMany(const size_t* hashes, size_t n) const
+	{
+		size_t found = n;
+		for (size_t i = n; i-- > 0;)
+			found = hashes[i] % 10 == 0 ? i : found;
+		return found;
+	}
+	// checks a mined block, its hash has to match its nonce and satisfy the puzzle
+	bool VerifyBlock(const Block& b) const override
+	{
+		return Verify(b.GetHash()) && MakeBlockHasher(b).Hash(b.GetNonce()) == b.GetHash();
+	}
+	// gives the calling miner a range of nonces no other miner will try
+	NonceSpace::Range LeaseNonces(size_t count)
+	{
+		return nonces.Lease(count);
+	}
+	// how many nonces of its leases a miner hashed, for the duplicate count
+	void ReportNoncesHashed(size_t count)
+	{
+		nonces.ReportHashed(count);
+	}
+	const NonceSpace& GetNonceSpace() const
+	{
+		return nonces;
+	}
 private:
 	Block block;
+	NonceSpace nonces;
 };
 
 template <typename T1, typename T2>
 std::shared_ptr<T1> MakePuzzle(const T2& t)
 {
 	return std::make_shared<T1>(t);
-}
\ No newline at end of file
+}
+
+// makes the puzzle in the manager's message pool
+template <typename T1, typename T2>
+std::shared_ptr<T1> MakePuzzle(ProcessManager& pm, const T2& t)
+{
+	return pm.MakeMessage<T1>(t);
+}
+
+// message handler for the hash puzzles, searches leased nonces until one satisfies the puzzle
+// nonces are hashed a batch at a time so the SIMD hashers can fill all their lanes
+template <typename Puzzle, typename Hasher = Sha256Midstate>
+std::optional<Block> SolveHashPuzzle(ProcessManager::MsgPtr puzzle_in, const ProcessManager::MinerContext& ctx)
+{
+	constexpr size_t batch_size = Sha256Midstate::maxLanes;
+	// nonces leased per trip to the shared counter
+	constexpr size_t lease_size = 16 * batch_size;
+
+	auto puzzle = (Puzzle*)puzzle_in.get();
+	// shares the puzzle's strings, only the mining info is the handler's own
+	Block block = puzzle->GetBlock();
+	const Hasher hasher = MakeBlockHasher<Hasher>(block);
+	size_t nonces[batch_size];
+	size_t hashes[batch_size];
+
+	while (true)
+	{
+		auto range = puzzle->LeaseNonces(lease_size);
+		for (size_t first = range.begin; first < range.end; first += batch_size)
+		{
+			for (size_t i = 0; i < batch_size; i++)
+				nonces[i] = first + i;
+			hasher.HashMany(nonces, batch_size, hashes);
+			size_t i = puzzle->VerifyMany(hashes, batch_size);
+			if (i != batch_size)
+			{
+				ctx.ReportHashes(first + batch_size - range.begin);
+				puzzle->ReportNoncesHashed(first + batch_size - range.begin);
+				block.UpdateMiningInfo(hashes[i], nonces[i]);
+				return block;
+			}
+		}
+		ctx.ReportHashes(range.end - range.begin);
+		puzzle->ReportNoncesHashed(range.end - range.begin);
+		// another miner already solved it
+		if (ctx.StopRequested())
+			return {};
+	}
+}
@@ -0,0 +1,80 @@
+#include "Random.h"
+#include <atomic>
+
+namespace
+{
+	uint64_t SplitMix64(uint64_t& x)
+	{
+		uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t Rotl(uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	std::atomic<uint64_t> runSeed = 0;
+	// bumped by SetRunSeed so threads know their generator is stale
+	std::atomic<uint64_t> generation = 0;
+	// streams handed out to threads for the current run seed
+	std::atomic<uint64_t> nextStream = 0;
+}
+
+Xoshiro256::Xoshiro256(uint64_t seed)
+{
+	for (auto& word : s)
+		word = SplitMix64(seed);
+}
+
+uint64_t Xoshiro256::Next()
+{
+	const uint64_t result = Rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = Rotl(s[3], 45);
+	return result;
+}
+
+uint32_t Xoshiro256::Below(uint32_t n)
+{
+	// scales the top 32 bits into the range (Lemire), no division
+	return uint32_t(((Next() >> 32) * n) >> 32);
+}
+
+void Random::SetRunSeed(uint64_t seed)
+{
+	runSeed = seed;
+	nextStream = 0;
+	generation++;
+}
+
+uint64_t Random::GetRunSeed()
+{
+	return runSeed;
+}
+
+uint64_t Random::SeedFor(uint64_t stream)
+{
+	uint64_t x = runSeed.load() ^ (stream * 0xD1B54A32D192ED03ULL);
+	return SplitMix64(x);
+}
+
+Xoshiro256& Random::ThreadRng()
+{
+	thread_local uint64_t seededFor = ~uint64_t(0);
+	thread_local Xoshiro256 rng(0);
+	const uint64_t current = generation.load();
+	if (seededFor != current)
+	{
+		rng = Xoshiro256(SeedFor(nextStream++));
+		seededFor = current;
+	}
+	return rng;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+
+// xoshiro256** by Blackman & Vigna, small, fast and good enough for anything that is not cryptography
+// one generator per thread means no shared state, unlike rand() which some CRTs guard with a lock
+class Xoshiro256
+{
+public:
+	// the state is filled from the seed with splitmix64 so any seed, 0 included, is fine
+	Xoshiro256(uint64_t seed);
+	uint64_t Next();
+	// a number in [0, n), n must not be 0
+	uint32_t Below(uint32_t n);
+
+private:
+	uint64_t s[4];
+};
+
+// every generator in a run is seeded from one run seed, so a run can be repeated by reusing it
+namespace Random
+{
+	// changes the run seed, threads reseed their generator the next time they use it
+	void SetRunSeed(uint64_t seed);
+	uint64_t GetRunSeed();
+	// seed for the given stream of the run, the same run seed and stream always give the same seed
+	uint64_t SeedFor(uint64_t stream);
+	// the calling thread's generator, threads get streams in the order they first ask for one
+	Xoshiro256& ThreadRng();
+}
@@ -0,0 +1,76 @@
+#include "ReaderPool.h"
+
+ReaderPool::ReaderPool(size_t num_threads)
+{
+	Start(num_threads);
+}
+
+ReaderPool::~ReaderPool()
+{
+	Stop();
+}
+
+std::future<void> ReaderPool::Submit(std::function<void()> f)
+{
+	std::packaged_task<void()> task(std::move(f));
+	auto res = task.get_future();
+	{
+		std::lock_guard<std::mutex> rg(resizeMtx);
+		std::lock_guard<std::mutex> g(mtx);
+		tasks.push_back(std::move(task));
+	}
+	cv.notify_one();
+	return res;
+}
+
+void ReaderPool::SetThreadCount(size_t num_threads)
+{
+	std::lock_guard<std::mutex> rg(resizeMtx);
+	Stop();
+	Start(num_threads);
+}
+
+size_t ReaderPool::GetThreadCount() const
+{
+	std::lock_guard<std::mutex> rg(resizeMtx);
+	return threads.size();
+}
+
+void ReaderPool::Start(size_t num_threads)
+{
+	if (num_threads == 0)
+		num_threads = 1;
+	stopping = false;
+	for (size_t i = 0; i < num_threads; i++)
+		threads.emplace_back([this]() { func(); });
+}
+
+void ReaderPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> g(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+}
+
+void ReaderPool::func()
+{
+	while (true)
+	{
+		std::packaged_task<void()> task;
+		{
+			std::unique_lock<std::mutex> lk(mtx);
+			cv.wait(lk, [this]() { return stopping || !tasks.empty(); });
+			// finish what was queued before stopping
+			if (tasks.empty())
+				return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
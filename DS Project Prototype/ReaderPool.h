@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a fixed set of threads that run queries against the miners' stores
+// kept apart from the miner threads so the number of queries running at once can be capped
+// without holding up mining
+class ReaderPool
+{
+public:
+	// starts num_threads readers, at least one
+	ReaderPool(size_t num_threads);
+	// runs the tasks already submitted and joins the readers
+	~ReaderPool();
+	ReaderPool(const ReaderPool&) = delete;
+	ReaderPool& operator=(const ReaderPool&) = delete;
+
+	// queues f to run on a reader, the future becomes ready once it has run
+	// and holds the exception if it threw
+	std::future<void> Submit(std::function<void()> f);
+	// replaces the readers with num_threads new ones once the queued tasks have run
+	void SetThreadCount(size_t num_threads);
+	size_t GetThreadCount() const;
+
+private:
+	void Start(size_t num_threads);
+	// lets the readers drain the queue, then joins them
+	void Stop();
+	// gets called once by each reader thread
+	void func();
+
+private:
+	// held by SetThreadCount and Submit so tasks are never queued while the readers are being swapped
+	mutable std::mutex resizeMtx;
+	// guards tasks and stopping
+	std::mutex mtx;
+	// signalled when a task is queued or the readers are told to stop
+	std::condition_variable cv;
+	std::deque<std::packaged_task<void()>> tasks;
+	bool stopping = false;
+	std::vector<std::thread> threads;
+};
@@ -0,0 +1,468 @@
+#include "Sha256.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+	const uint32_t K[64] =
+	{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+	const uint32_t initialState[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	uint32_t LoadBE(const uint8_t* p)
+	{
+		return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+	}
+
+	uint32_t Rotr(uint32_t x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	void CompressScalar(uint32_t state[8], const uint32_t block[16])
+	{
+		uint32_t w[64];
+		for (int i = 0; i < 16; i++)
+			w[i] = block[i];
+		for (int i = 16; i < 64; i++)
+		{
+			uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; i++)
+		{
+			uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+
+	// one block with the SHA extensions, the state is kept as ABEF/CDGH as the instructions expect
+	void CompressShaNi(uint32_t state[8], const uint32_t block[16])
+	{
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1); // CDAB
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B); // EFGH
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+		const __m128i abef = state0;
+		const __m128i cdgh = state1;
+
+		__m128i w[4];
+		for (int i = 0; i < 16; i++)
+		{
+			if (i < 4)
+				w[i] = _mm_loadu_si128((const __m128i*)&block[i * 4]);
+			else
+			{
+				// w[i] = msg2(msg1(w[i-4], w[i-3]) + w[i-7 .. i-4], w[i-1]) in groups of four words
+				__m128i t = _mm_alignr_epi8(w[(i - 1) & 3], w[(i - 2) & 3], 4);
+				t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i - 3) & 3]), t);
+				w[i & 3] = _mm_sha256msg2_epu32(t, w[(i - 1) & 3]);
+			}
+			__m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i*)&K[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+		state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+		_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0)); // DCBA
+		_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+	}
+
+	// thin wrappers over each vector width so a single compression routine serves all of them
+	struct SseLanes
+	{
+		typedef __m128i V;
+		static constexpr size_t lanes = 4;
+		static V Load(const uint32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static void Store(uint32_t* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+		static V Set1(uint32_t x) { return _mm_set1_epi32(int(x)); }
+		static V Add(V a, V b) { return _mm_add_epi32(a, b); }
+		static V Xor(V a, V b) { return _mm_xor_si128(a, b); }
+		static V And(V a, V b) { return _mm_and_si128(a, b); }
+		static V AndNot(V a, V b) { return _mm_andnot_si128(a, b); }
+		static V Or(V a, V b) { return _mm_or_si128(a, b); }
+		template <int N> static V Shr(V a) { return _mm_srli_epi32(a, N); }
+		template <int N> static V Shl(V a) { return _mm_slli_epi32(a, N); }
+	};
+
+	struct Avx2Lanes
+	{
+		typedef __m256i V;
+		static constexpr size_t lanes = 8;
+		static V Load(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+		static void Store(uint32_t* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+		static V Set1(uint32_t x) { return _mm256_set1_epi32(int(x)); }
+		static V Add(V a, V b) { return _mm256_add_epi32(a, b); }
+		static V Xor(V a, V b) { return _mm256_xor_si256(a, b); }
+		static V And(V a, V b) { return _mm256_and_si256(a, b); }
+		static V AndNot(V a, V b) { return _mm256_andnot_si256(a, b); }
+		static V Or(V a, V b) { return _mm256_or_si256(a, b); }
+		template <int N> static V Shr(V a) { return _mm256_srli_epi32(a, N); }
+		template <int N> static V Shl(V a) { return _mm256_slli_epi32(a, N); }
+	};
+
+	struct Avx512Lanes
+	{
+		typedef __m512i V;
+		static constexpr size_t lanes = 16;
+		static V Load(const uint32_t* p) { return _mm512_loadu_si512(p); }
+		static void Store(uint32_t* p, V v) { _mm512_storeu_si512(p, v); }
+		static V Set1(uint32_t x) { return _mm512_set1_epi32(int(x)); }
+		static V Add(V a, V b) { return _mm512_add_epi32(a, b); }
+		static V Xor(V a, V b) { return _mm512_xor_si512(a, b); }
+		static V And(V a, V b) { return _mm512_and_si512(a, b); }
+		static V AndNot(V a, V b) { return _mm512_andnot_si512(a, b); }
+		static V Or(V a, V b) { return _mm512_or_si512(a, b); }
+		template <int N> static V Shr(V a) { return _mm512_srli_epi32(a, N); }
+		template <int N> static V Shl(V a) { return _mm512_slli_epi32(a, N); }
+	};
+
+	template <typename L, int N>
+	typename L::V RotrLanes(typename L::V x)
+	{
+		return L::Or(L::template Shr<N>(x), L::template Shl<32 - N>(x));
+	}
+
+	// compresses one block in every lane, words holds word j of lane l at [j * lanes + l]
+	template <typename L>
+	void CompressLanes(typename L::V state[8], const uint32_t* words)
+	{
+		typedef typename L::V V;
+		V w[16];
+		for (int i = 0; i < 16; i++)
+			w[i] = L::Load(words + i * L::lanes);
+
+		V a = state[0], b = state[1], c = state[2], d = state[3];
+		V e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; i++)
+		{
+			// the schedule is kept as a rolling window of 16 words
+			if (i >= 16)
+			{
+				V w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				V s0 = L::Xor(L::Xor(RotrLanes<L, 7>(w15), RotrLanes<L, 18>(w15)), L::template Shr<3>(w15));
+				V s1 = L::Xor(L::Xor(RotrLanes<L, 17>(w2), RotrLanes<L, 19>(w2)), L::template Shr<10>(w2));
+				w[i & 15] = L::Add(L::Add(w[i & 15], s0), L::Add(w[(i - 7) & 15], s1));
+			}
+			V S1 = L::Xor(L::Xor(RotrLanes<L, 6>(e), RotrLanes<L, 11>(e)), RotrLanes<L, 25>(e));
+			V ch = L::Xor(L::And(e, f), L::AndNot(e, g));
+			V t1 = L::Add(L::Add(L::Add(h, S1), L::Add(ch, L::Set1(K[i]))), w[i & 15]);
+			V S0 = L::Xor(L::Xor(RotrLanes<L, 2>(a), RotrLanes<L, 13>(a)), RotrLanes<L, 22>(a));
+			V maj = L::Xor(L::Xor(L::And(a, b), L::And(a, c)), L::And(b, c));
+			V t2 = L::Add(S0, maj);
+			h = g; g = f; f = e; e = L::Add(d, t1);
+			d = c; c = b; b = a; a = L::Add(t1, t2);
+		}
+		state[0] = L::Add(state[0], a); state[1] = L::Add(state[1], b);
+		state[2] = L::Add(state[2], c); state[3] = L::Add(state[3], d);
+		state[4] = L::Add(state[4], e); state[5] = L::Add(state[5], f);
+		state[6] = L::Add(state[6], g); state[7] = L::Add(state[7], h);
+	}
+
+	void Compress(Sha256Midstate::Impl impl, uint32_t state[8], const uint32_t block[16])
+	{
+		if (impl == Sha256Midstate::Impl::ShaNi)
+			CompressShaNi(state, block);
+		else
+			CompressScalar(state, block);
+	}
+
+	// reads the leading bytes of the digest as a big endian integer
+	size_t TopOfDigest(uint32_t s0, uint32_t s1)
+	{
+		if constexpr (sizeof(size_t) == 8)
+			return size_t((uint64_t(s0) << 32) | s1);
+		else
+			return size_t(s0);
+	}
+
+	// what the cpu (and the os, for the wider registers) supports, detected once
+	struct CpuFeatures
+	{
+		bool sse41 = false;
+		bool avx2 = false;
+		bool avx512 = false;
+		bool sha = false;
+	};
+
+	CpuFeatures DetectCpuFeatures()
+	{
+		CpuFeatures features;
+		int info[4];
+		__cpuid(info, 0);
+		const int max_leaf = info[0];
+		__cpuid(info, 1);
+		features.sse41 = (info[2] & (1 << 19)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+
+		bool ymm = false, zmm = false;
+		if (osxsave && avx)
+		{
+			unsigned long long xcr0 = _xgetbv(0);
+			ymm = (xcr0 & 0x6) == 0x6;
+			zmm = (xcr0 & 0xE6) == 0xE6;
+		}
+
+		if (max_leaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			features.avx2 = ymm && (info[1] & (1 << 5)) != 0;
+			features.avx512 = zmm && (info[1] & (1 << 16)) != 0;
+			features.sha = features.sse41 && (info[1] & (1 << 29)) != 0;
+		}
+		return features;
+	}
+
+	const CpuFeatures& GetCpuFeatures()
+	{
+		static const CpuFeatures features = DetectCpuFeatures();
+		return features;
+	}
+}
+
+Sha256Midstate::Sha256Midstate(std::initializer_list<std::string_view> prefix)
+	:
+	impl(BestImpl())
+{
+	std::memcpy(midstate, initialState, sizeof(midstate));
+	uint32_t block[16];
+	for (auto& piece : prefix)
+	{
+		for (char ch : piece)
+		{
+			tail.push_back(ch);
+			if (tail.size() == 64)
+			{
+				for (int i = 0; i < 16; i++)
+					block[i] = LoadBE((const uint8_t*)tail.data() + i * 4);
+				Compress(impl, midstate, block);
+				tail.clear();
+			}
+		}
+		prefixLen += piece.size();
+	}
+}
+
+size_t Sha256Midstate::BuildTail(size_t nonce, uint32_t words[32]) const
+{
+	uint8_t buf[128] = {};
+	std::memcpy(buf, tail.data(), tail.size());
+	char* digits = (char*)buf + tail.size();
+	const size_t len = tail.size() + (std::to_chars(digits, digits + 24, nonce).ptr - digits);
+	buf[len] = 0x80;
+
+	// the last 8 bytes hold the length of the whole message in bits
+	const size_t blocks = len + 9 <= 64 ? 1 : 2;
+	const uint64_t bits = (prefixLen + (len - tail.size())) * 8;
+	for (int i = 0; i < 8; i++)
+		buf[blocks * 64 - 1 - i] = uint8_t(bits >> (8 * i));
+
+	for (size_t i = 0; i < blocks * 16; i++)
+		words[i] = LoadBE(buf + i * 4);
+	return blocks;
+}
+
+size_t Sha256Midstate::Hash(size_t nonce) const
+{
+	uint32_t words[32];
+	uint32_t state[8];
+	std::memcpy(state, midstate, sizeof(state));
+	const size_t blocks = BuildTail(nonce, words);
+	for (size_t b = 0; b < blocks; b++)
+		Compress(impl, state, words + b * 16);
+	return TopOfDigest(state[0], state[1]);
+}
+
+template <typename Lanes>
+void Sha256Midstate::HashLanes(const size_t* nonces, size_t* out) const
+{
+	constexpr size_t lanes = Lanes::lanes;
+	uint32_t tails[lanes][32];
+	size_t blocks = BuildTail(nonces[0], tails[0]);
+	for (size_t l = 1; l < lanes; l++)
+	{
+		// the lanes have to agree on the number of blocks, which only fails
+		// when the nonces straddle a digit count that pushes the tail into a second block
+		if (BuildTail(nonces[l], tails[l]) != blocks)
+		{
+			for (size_t i = 0; i < lanes; i++)
+				out[i] = Hash(nonces[i]);
+			return;
+		}
+	}
+
+	typename Lanes::V state[8];
+	for (int i = 0; i < 8; i++)
+		state[i] = Lanes::Set1(midstate[i]);
+
+	alignas(64) uint32_t words[16 * lanes];
+	for (size_t b = 0; b < blocks; b++)
+	{
+		for (size_t j = 0; j < 16; j++)
+		{
+			for (size_t l = 0; l < lanes; l++)
+				words[j * lanes + l] = tails[l][b * 16 + j];
+		}
+		CompressLanes<Lanes>(state, words);
+	}
+
+	alignas(64) uint32_t s0[lanes], s1[lanes];
+	Lanes::Store(s0, state[0]);
+	Lanes::Store(s1, state[1]);
+	for (size_t l = 0; l < lanes; l++)
+		out[l] = TopOfDigest(s0[l], s1[l]);
+}
+
+void Sha256Midstate::HashMany(const size_t* nonces, size_t n, size_t* out) const
+{
+	size_t i = 0;
+	switch (impl)
+	{
+	case Impl::Avx512:
+		for (; i + Avx512Lanes::lanes <= n; i += Avx512Lanes::lanes)
+			HashLanes<Avx512Lanes>(nonces + i, out + i);
+		break;
+	case Impl::Avx2:
+		for (; i + Avx2Lanes::lanes <= n; i += Avx2Lanes::lanes)
+			HashLanes<Avx2Lanes>(nonces + i, out + i);
+		break;
+	case Impl::Sse41:
+		for (; i + SseLanes::lanes <= n; i += SseLanes::lanes)
+			HashLanes<SseLanes>(nonces + i, out + i);
+		break;
+	default:
+		break;
+	}
+	// whatever did not fill a whole vector
+	for (; i < n; i++)
+		out[i] = Hash(nonces[i]);
+}
+
+bool Sha256Midstate::SetImpl(Impl new_impl)
+{
+	if (!Supported(new_impl))
+		return false;
+	impl = new_impl;
+	return true;
+}
+
+Sha256Midstate::Impl Sha256Midstate::GetImpl() const
+{
+	return impl;
+}
+
+Sha256Midstate::Impl Sha256Midstate::BestImpl()
+{
+	// 16 lanes of avx-512 beat the sha extensions, which in turn beat 8 lanes of avx2
+	// ("--bench sha256" shows the numbers for the current machine)
+	const CpuFeatures& cpu = GetCpuFeatures();
+	if (cpu.avx512)
+		return Impl::Avx512;
+	if (cpu.sha)
+		return Impl::ShaNi;
+	if (cpu.avx2)
+		return Impl::Avx2;
+	if (cpu.sse41)
+		return Impl::Sse41;
+	return Impl::Scalar;
+}
+
+bool Sha256Midstate::Supported(Impl impl)
+{
+	const CpuFeatures& cpu = GetCpuFeatures();
+	switch (impl)
+	{
+	case Impl::ShaNi:
+		return cpu.sha;
+	case Impl::Sse41:
+		return cpu.sse41;
+	case Impl::Avx2:
+		return cpu.avx2;
+	case Impl::Avx512:
+		return cpu.avx512;
+	default:
+		return true;
+	}
+}
+
+const char* Sha256Midstate::GetImplName(Impl impl)
+{
+	switch (impl)
+	{
+	case Impl::ShaNi:
+		return "sha-ni";
+	case Impl::Sse41:
+		return "sse4.1 x4";
+	case Impl::Avx2:
+		return "avx2 x8";
+	case Impl::Avx512:
+		return "avx-512 x16";
+	default:
+		return "scalar";
+	}
+}
+
+std::array<uint8_t, 32> Sha256Midstate::Digest(std::string_view data, Impl impl)
+{
+	uint32_t state[8];
+	std::memcpy(state, initialState, sizeof(state));
+
+	// whole blocks first, then the padded remainder
+	uint32_t block[16];
+	size_t pos = 0;
+	for (; pos + 64 <= data.size(); pos += 64)
+	{
+		for (int i = 0; i < 16; i++)
+			block[i] = LoadBE((const uint8_t*)data.data() + pos + i * 4);
+		Compress(impl, state, block);
+	}
+	uint8_t buf[128] = {};
+	const size_t rest = data.size() - pos;
+	std::memcpy(buf, data.data() + pos, rest);
+	buf[rest] = 0x80;
+	const size_t blocks = rest + 9 <= 64 ? 1 : 2;
+	const uint64_t bits = uint64_t(data.size()) * 8;
+	for (int i = 0; i < 8; i++)
+		buf[blocks * 64 - 1 - i] = uint8_t(bits >> (8 * i));
+	for (size_t b = 0; b < blocks; b++)
+	{
+		for (int i = 0; i < 16; i++)
+			block[i] = LoadBE(buf + b * 64 + i * 4);
+		Compress(impl, state, block);
+	}
+
+	std::array<uint8_t, 32> digest;
+	for (int i = 0; i < 8; i++)
+	{
+		digest[i * 4] = uint8_t(state[i] >> 24);
+		digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+		digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+		digest[i * 4 + 3] = uint8_t(state[i]);
+	}
+	return digest;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+// SHA-256 of a constant prefix followed by a decimal nonce, used by the puzzles so mined blocks
+// can be verified by any node, unlike std::hash which differs between standard libraries
+// the state over the whole 64 byte blocks of the prefix is computed once, every attempt only
+// compresses the last one or two blocks, several nonces at a time when the cpu has SIMD support
+class Sha256Midstate
+{
+public:
+	// the ways a block can be compressed, picked at runtime from what the cpu supports
+	enum class Impl
+	{
+		Scalar,
+		ShaNi,	// SHA extensions, one nonce at a time
+		Sse41,	// 4 nonces at a time
+		Avx2,	// 8 nonces at a time
+		Avx512	// 16 nonces at a time
+	};
+	// the most nonces HashMany hashes in one go
+	static constexpr size_t maxLanes = 16;
+
+public:
+	// hashes the given pieces one after another as if they were concatenated
+	// uses the fastest implementation the cpu supports
+	Sha256Midstate(std::initializer_list<std::string_view> prefix);
+	// first bytes of the digest of the prefix followed by the nonce, read as a big endian integer
+	size_t Hash(size_t nonce) const;
+	// hashes n nonces into out, n can be anything but multiples of maxLanes are fastest
+	void HashMany(const size_t* nonces, size_t n, size_t* out) const;
+
+	// forces a specific implementation, mostly for benchmarks
+	// returns false and changes nothing if the cpu does not support it
+	bool SetImpl(Impl impl);
+	Impl GetImpl() const;
+
+	// the implementation picked for this cpu
+	static Impl BestImpl();
+	static bool Supported(Impl impl);
+	static const char* GetImplName(Impl impl);
+	// full digest of a string, used to check the implementations against each other
+	static std::array<uint8_t, 32> Digest(std::string_view data, Impl impl = Impl::Scalar);
+
+private:
+	// writes the padded last block(s) for the nonce as words, returns how many blocks there are
+	size_t BuildTail(size_t nonce, uint32_t words[32]) const;
+	// hashes lanes nonces with the multi-buffer implementation
+	template <typename Lanes>
+	void HashLanes(const size_t* nonces, size_t* out) const;
+
+private:
+	// state after the whole blocks of the prefix
+	uint32_t midstate[8];
+	// bytes of the prefix after the last whole block, always less than 64
+	std::string tail;
+	// length of the prefix in bytes
+	uint64_t prefixLen = 0;
+	Impl impl;
+};
@@ -0,0 +1,229 @@
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	struct Event
+	{
+		const char* name;
+		int64_t ns;
+		uint64_t msgID;
+		// chrome's phase letter, 'i' instant, 'B' begin, 'E' end
+		char phase;
+	};
+
+	// one thread's events, only the owning thread writes to it
+	// events live in a linked list of fixed size chunks that never move, so a reader
+	// can walk them while the owner keeps appending
+	class ThreadBuffer
+	{
+	public:
+		static constexpr size_t chunkSize = 4096;
+		struct Chunk
+		{
+			Event events[chunkSize];
+			std::atomic<Chunk*> next = nullptr;
+		};
+
+	public:
+		ThreadBuffer(uint32_t tid)
+			:
+			tid(tid)
+		{
+		}
+		~ThreadBuffer()
+		{
+			Chunk* c = head.load();
+			while (c)
+			{
+				Chunk* next = c->next.load();
+				delete c;
+				c = next;
+			}
+		}
+		void Push(const Event& e)
+		{
+			const size_t n = count.load(std::memory_order_relaxed);
+			if (n % chunkSize == 0)
+			{
+				Chunk* c = new Chunk;
+				if (tail)
+					tail->next.store(c, std::memory_order_release);
+				else
+					head.store(c, std::memory_order_release);
+				tail = c;
+			}
+			tail->events[n % chunkSize] = e;
+			// publishes the event to readers
+			count.store(n + 1, std::memory_order_release);
+		}
+		// calls f for every event from index start up to what had been published when it was called
+		template <typename F>
+		void ForEach(size_t start, F f) const
+		{
+			const size_t n = count.load(std::memory_order_acquire);
+			const Chunk* c = head.load(std::memory_order_acquire);
+			for (size_t i = 0; i < n; i++)
+			{
+				if (i != 0 && i % chunkSize == 0)
+					c = c->next.load(std::memory_order_acquire);
+				if (i >= start)
+					f(c->events[i % chunkSize]);
+			}
+		}
+		size_t GetCount() const
+		{
+			return count.load(std::memory_order_acquire);
+		}
+
+	public:
+		const uint32_t tid;
+		// set and read under the registry mutex
+		std::string name;
+		// events before this index were recorded before the last Start
+		std::atomic<size_t> start = 0;
+
+	private:
+		std::atomic<Chunk*> head = nullptr;
+		// only used by the owning thread
+		Chunk* tail = nullptr;
+		std::atomic<size_t> count = 0;
+	};
+
+	std::atomic<bool> enabled = false;
+	std::atomic<int64_t> startNs = 0;
+
+	// owns every thread's buffer, buffers outlive their threads so their events can still be written
+	std::mutex registryMtx;
+	std::vector<std::unique_ptr<ThreadBuffer>>& Registry()
+	{
+		static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		return buffers;
+	}
+
+	// a thread only gets a buffer once it records an event, so threads that run while tracing is off
+	// never touch the registry
+	thread_local ThreadBuffer* localBuffer = nullptr;
+	// set by SetThreadName, copied into the thread's buffer when it is made
+	thread_local std::string threadName;
+
+	ThreadBuffer& LocalBuffer()
+	{
+		if (!localBuffer)
+		{
+			std::lock_guard<std::mutex> g(registryMtx);
+			auto& buffers = Registry();
+			buffers.push_back(std::make_unique<ThreadBuffer>(uint32_t(buffers.size() + 1)));
+			localBuffer = buffers.back().get();
+			localBuffer->name = threadName;
+		}
+		return *localBuffer;
+	}
+
+	int64_t NowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Record(const char* name, char phase, uint64_t msg_id)
+	{
+		if (!enabled.load(std::memory_order_relaxed))
+			return;
+		LocalBuffer().Push({ name, NowNs(), msg_id, phase });
+	}
+}
+
+void Trace::Start()
+{
+	{
+		std::lock_guard<std::mutex> g(registryMtx);
+		for (auto& b : Registry())
+			b->start = b->GetCount();
+	}
+	startNs = NowNs();
+	enabled = true;
+}
+
+void Trace::Stop()
+{
+	enabled = false;
+}
+
+bool Trace::Enabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+void Trace::SetThreadName(const std::string& name)
+{
+	threadName = name;
+	if (localBuffer)
+	{
+		std::lock_guard<std::mutex> g(registryMtx);
+		localBuffer->name = name;
+	}
+}
+
+void Trace::Instant(const char* name, uint64_t msg_id)
+{
+	Record(name, 'i', msg_id);
+}
+
+void Trace::Begin(const char* name, uint64_t msg_id)
+{
+	Record(name, 'B', msg_id);
+}
+
+void Trace::End(const char* name, uint64_t msg_id)
+{
+	Record(name, 'E', msg_id);
+}
+
+void Trace::WriteFile(const std::string& filename)
+{
+	std::ofstream out(filename);
+	if (!out)
+		throw std::exception("Could not open trace file");
+
+	const int64_t origin = startNs;
+	bool first = true;
+	auto separator = [&out, &first]()
+	{
+		out << (first ? "\n" : ",\n");
+		first = false;
+	};
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	std::lock_guard<std::mutex> g(registryMtx);
+	for (auto& b : Registry())
+	{
+		if (!b->name.empty())
+		{
+			separator();
+			out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"args\":{\"name\":\"" << b->name << "\"}}";
+		}
+		b->ForEach(b->start, [&](const Event& e)
+			{
+				separator();
+				// chrome wants microseconds, fractions keep the nanoseconds
+				out << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << (e.ns - origin) / 1000.0
+					<< ",\"pid\":1,\"tid\":" << b->tid;
+				if (e.phase == 'i')
+					out << ",\"s\":\"t\"";
+				out << ",\"args\":{\"msg\":" << e.msgID << "}}";
+			}
+		);
+	}
+	out << "\n]}\n";
+	if (!out)
+		throw std::exception("Could not write trace file");
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// records what happens to messages on every thread and writes it out in the chrome trace event format,
+// which chrome://tracing and Perfetto can open
+// each thread appends to its own buffer without locking, the buffers are only read when the trace is written
+// recording an event is a no-op costing one atomic load while tracing is off, and a thread that never records one
+// never gets a buffer
+namespace Trace
+{
+	// starts recording, anything recorded earlier is dropped
+	void Start();
+	void Stop();
+	bool Enabled();
+
+	// names the calling thread in the trace, the name is kept by the thread until it records its first event
+	void SetThreadName(const std::string& name);
+	// an event at a point in time about the given message, name must be a string literal
+	void Instant(const char* name, uint64_t msg_id);
+	// the start and end of a span on the calling thread, spans on one thread must nest
+	void Begin(const char* name, uint64_t msg_id);
+	void End(const char* name, uint64_t msg_id);
+
+	// writes everything recorded since Start as a json trace, throws if the file cannot be written
+	// threads can keep recording while this runs, their newest events may be left out
+	void WriteFile(const std::string& filename);
+}